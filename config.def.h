@@ -19,6 +19,7 @@ static const int showbar            = 1;        /* 0 means no bar */
 static const int showebar           = 1;        /* 0 means no extra bar */
 static const int topbar             = 1;        /* 0 means bottom bar */
 static const int notileborder       = 1;        /* 1 disables tiled borders for non-small gaps */
+static const int presizehidden      = 0;        /* 1 lays out hidden tags offscreen so viewing them only moves windows */
 static const unsigned int systraypinning = 0;   /* 0: sloppy systray follows selected monitor, >0: pin systray to monitor X */
 static const unsigned int systrayspacing = 0;   /* systray spacing */
 static const int systraypinningfailfirst = 1;   /* 1: if pinning fails, display systray on the first monitor, False: display systray on the last monitor*/
@@ -118,6 +119,9 @@ static const int nmaster     = 1;    /* number of clients in master area */
 static const int resizehints = 0;    /* 1 means respect size hints in tiled resizals */
 static const int resizehintsbm = 0;    /* resizehints for > resizehintsbm * borderpixel */
 static const int reshintsoffondrag = 1;  /* deaktivate resizehints on dragfact */
+static const int dragoutline = 0;  /* 1 drags an outline, windows follow on release */
+static const int dragrate = 60;    /* live drag updates per second if the refresh rate is unknown, at least 1 */
+static const int synctimeout = 1000; /* ms a resize waits for _NET_WM_SYNC_REQUEST to be answered, a client missing it is no longer asked */
 static const int attachdirection = 0;    /* 0 default, 1 above, 2 aside, 3 below, 4 bottom, 5 top */
 static const int  layoutaxis[] = {
 	1,    /* layout axis: 1 = x, 2 = y; negative values mirror the layout */
@@ -266,4 +270,5 @@ static Button buttons[] = {
 static Signal signals[] = {
 	/* signum       function        argument  */
 	{ 1,            setlayout,      {.v = 0} },
+	{ 2,            dumpstats,      {0} },
 };
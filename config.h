@@ -31,6 +31,7 @@ static const int showebar           = 1;        /* 0 means no extra bar */
 static const int topbar             = 1;        /* 0 means bottom bar */
 static const int statuslastblock    = 1;        /* 1 means last item in statusbar is displayed as block */
 static const int notileborder       = 1;        /* 1 disables tiled borders for non-small gaps */
+static const int presizehidden      = 0;        /* 1 lays out hidden tags offscreen so viewing them only moves windows */
 static const int oneclientdimmer    = 1;        /* 1 makes tab for one client in unfocused color... */
 static const int istatustimeout     = 5;              /* max timeout before displaying regular status after istatus */
 static const char istatusprefix[]   = "msg: ";         /* prefix for important status messages */
@@ -140,6 +141,9 @@ static const int nmaster     = 1;    /* number of clients in master area */
 static const int resizehints = 1;    /* 1 means respect size hints in tiled resizals */
 static const int resizehintsbm = 3;    /* resizehints for > resizehintsbm * borderpixel */
 static const int reshintsoffondrag = 0;  /* deaktivate resizehints on dragfact */
+static const int dragoutline = 0;  /* 1 drags an outline, windows follow on release */
+static const int dragrate = 60;    /* live drag updates per second if the refresh rate is unknown, at least 1 */
+static const int synctimeout = 1000; /* ms a resize waits for _NET_WM_SYNC_REQUEST to be answered, a client missing it is no longer asked */
 static const int attachdirection = 2;    /* 0 default, 1 above, 2 aside, 3 below, 4 bottom, 5 top */
 static const int  layoutaxis[] = {
 	1,    /* layout axis: 1 = x, 2 = y; negative values mirror the layout */
@@ -308,4 +312,5 @@ static Signal signals[] = {
 	/* dwmblocks click */
 	{ 4,            togglescratch,  {.v = alsam } },
 	{ 5,            togglescratch,  {.v = pulsm } },
+	{ 6,            dumpstats,      {0} },
 };
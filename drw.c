@@ -1,7 +1,12 @@
 /* See LICENSE file for copyright and license details. */
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <X11/Xlib.h>
 #include <X11/Xft/Xft.h>
 
@@ -10,12 +15,37 @@
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define LENGTH(X)   (sizeof (X) / sizeof (X)[0])
+#define MAXFALLBACK 16 /* fallback fonts kept loaded */
+#define CACHEMAGIC  "dwmfnt1"
+#define CACHEMAXCP  65536 /* codepoints read back from a cache file */
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
 static const long utfmin[UTF_SIZ + 1] = {       0,    0,  0x80,  0x800,  0x10000};
 static const long utfmax[UTF_SIZ + 1] = {0x10FFFF, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
 
+/* On-disk layout of the fallback font cache, a header followed by the
+ * ranges sorted by codepoint and the fallback font patterns, each NUL
+ * terminated. It is only read back by the same build on the same
+ * machine, so the fields are in host byte order. */
+typedef struct {
+	char magic[8];
+	uint64_t stamp;   /* fontconfig_stamp() when written */
+	uint64_t key;     /* fontset_key() when written */
+	uint32_t nranges, nfonts;
+} CacheHeader;
+
+typedef struct {
+	uint32_t lo, hi;
+	int32_t font;     /* index of the pattern, -1 if no font has them */
+} CacheRange;
+
+typedef struct {
+	long cp;
+	int32_t font;
+} CacheEntry;
+
 static long
 utf8decodebyte(const char c, size_t *i)
 {
@@ -60,6 +90,83 @@ utf8decode(const char *c, long *u, size_t clen)
 	return len;
 }
 
+/* forgets the measured and shaped strings */
+static void
+textcache_flush(Drw *drw)
+{
+	size_t i;
+
+	for (i = 0; i < LENGTH(drw->widths); i++) {
+		free(drw->widths[i].text);
+		drw->widths[i].text = NULL;
+		drw->widths[i].used = 0;
+	}
+	for (i = 0; i < LENGTH(drw->runs); i++) {
+		free(drw->runs[i].text);
+		free(drw->runs[i].specs);
+		drw->runs[i].text = NULL;
+		drw->runs[i].specs = NULL;
+		drw->runs[i].used = 0;
+	}
+}
+
+/* forgets which font has which codepoint and all measured widths, they
+ * depend on the fonts in the set */
+static void
+glyphcache_flush(Drw *drw)
+{
+	size_t i;
+
+	for (i = 0; i < LENGTH(drw->latin); i++)
+		drw->latin[i].resolved = 0;
+	free(drw->glyphs);
+	drw->glyphs = NULL;
+	drw->glyphsize = drw->nglyphs = 0;
+	textcache_flush(drw);
+}
+
+/* cache slot of cp, added unresolved if missing */
+static CharFont *
+glyph_slot(Drw *drw, long cp)
+{
+	CharFont *old;
+	unsigned int i, j, mask, oldsize;
+
+	if (cp < (long)LENGTH(drw->latin))
+		return &drw->latin[cp];
+	if (drw->glyphsize) {
+		mask = drw->glyphsize - 1;
+		for (i = (unsigned long)cp * 2654435761UL & mask; drw->glyphs[i].cp != -1; i = (i + 1) & mask)
+			if (drw->glyphs[i].cp == cp)
+				return &drw->glyphs[i];
+	}
+	/* keep the table at most half full */
+	if (2 * (drw->nglyphs + 1) > drw->glyphsize) {
+		old = drw->glyphs;
+		oldsize = drw->glyphsize;
+		drw->glyphsize = oldsize ? 2 * oldsize : 256;
+		drw->glyphs = ecalloc(drw->glyphsize, sizeof(CharFont));
+		for (i = 0; i < drw->glyphsize; i++)
+			drw->glyphs[i].cp = -1;
+		mask = drw->glyphsize - 1;
+		for (j = 0; j < oldsize; j++) {
+			if (old[j].cp == -1)
+				continue;
+			for (i = (unsigned long)old[j].cp * 2654435761UL & mask; drw->glyphs[i].cp != -1; i = (i + 1) & mask)
+				;
+			drw->glyphs[i] = old[j];
+		}
+		free(old);
+	}
+	mask = drw->glyphsize - 1;
+	for (i = (unsigned long)cp * 2654435761UL & mask; drw->glyphs[i].cp != -1; i = (i + 1) & mask)
+		;
+	drw->glyphs[i].cp = cp;
+	drw->glyphs[i].resolved = 0;
+	drw->nglyphs++;
+	return &drw->glyphs[i];
+}
+
 Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h, Visual *visual, unsigned int depth, Colormap cmap)
 {
@@ -76,6 +183,7 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->drawable = XCreatePixmap(dpy, root, w, h, depth);
 	drw->gc = XCreateGC(dpy, drw->drawable, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
+	glyphcache_flush(drw);
 
 	return drw;
 }
@@ -99,6 +207,8 @@ drw_free(Drw *drw)
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
+	glyphcache_flush(drw);
+	free(drw->specs);
 	free(drw);
 }
 
@@ -169,6 +279,117 @@ xfont_free(Fnt *font)
 	free(font);
 }
 
+/* unlinks and frees a fallback font, the codepoints it had are looked
+ * up again when next drawn */
+static void
+fallback_evict(Drw *drw, Fnt *font)
+{
+	Fnt **f;
+	size_t i;
+
+	for (f = &drw->fonts; *f && *f != font; f = &(*f)->next)
+		;
+	if (!*f)
+		return;
+	*f = font->next;
+	for (i = 0; i < LENGTH(drw->latin); i++)
+		if (drw->latin[i].font == font)
+			drw->latin[i].resolved = 0;
+	for (i = 0; i < drw->glyphsize; i++)
+		if (drw->glyphs[i].cp != -1 && drw->glyphs[i].font == font)
+			drw->glyphs[i].resolved = 0;
+	textcache_flush(drw);
+	xfont_free(font);
+}
+
+/* asks fontconfig for a font having cp and appends it to the set, making
+ * room by evicting the least recently used fallback font that no glyph
+ * since drw->fontpin was resolved to */
+static Fnt *
+fallback_load(Drw *drw, long cp)
+{
+	Fnt *font, *f, *lru = NULL;
+	FcCharSet *fccharset;
+	FcPattern *fcpattern;
+	FcPattern *match;
+	XftResult result;
+	int n = 0;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, cp);
+
+	fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+	FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
+
+	FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+	FcDefaultSubstitute(fcpattern);
+	match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+
+	FcCharSetDestroy(fccharset);
+	FcPatternDestroy(fcpattern);
+
+	if (!match || !(font = xfont_create(drw, NULL, match)))
+		return NULL;
+	if (!XftCharExists(drw->dpy, font->xfont, cp)) {
+		xfont_free(font);
+		return NULL;
+	}
+	for (f = drw->fonts; f; f = f->next)
+		if (f->fallback && (n++, f->used <= drw->fontpin) && (!lru || f->used < lru->used))
+			lru = f;
+	if (n >= MAXFALLBACK && lru)
+		fallback_evict(drw, lru);
+	for (f = drw->fonts; f->next; f = f->next)
+		; /* NOP */
+	f->next = font;
+	font->fallback = 1;
+	return font;
+}
+
+/* the cache entry of cp, resolved to the font drw_text() draws it with.
+ * Codepoints no font has, not even a fallback, are remembered as such
+ * and drawn as the missing glyph of the first font. */
+static CharFont *
+glyph_resolve(Drw *drw, long cp)
+{
+	CharFont *g = glyph_slot(drw, cp);
+	Fnt *f;
+
+	if (!g->resolved) {
+		for (f = drw->fonts; f && !XftCharExists(drw->dpy, f->xfont, cp); f = f->next)
+			;
+		g->font = f ? f : fallback_load(drw, cp);
+		g->w = ~0U;
+		g->resolved = 1;
+	}
+	if (g->font && g->font->fallback)
+		g->font->used = ++drw->fontclock;
+	return g;
+}
+
+/* advance of the character s[0..len) decoded to cp */
+static unsigned int
+glyph_advance(Drw *drw, long cp, const char *s, size_t len)
+{
+	CharFont *g = glyph_resolve(drw, cp);
+	unsigned int w;
+
+	if (g->w != ~0U)
+		return g->w;
+	drw_font_getexts(g->font ? g->font : drw->fonts, s, len, &w, NULL);
+	/* invalid sequences are measured as whatever bytes they are made of */
+	if (cp != UTF_INVALID)
+		g->w = w;
+	return w;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -184,6 +405,7 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
+	glyphcache_flush(drw);
 	return (drw->fonts = ret);
 }
 
@@ -196,6 +418,209 @@ drw_fontset_free(Fnt *font)
 	}
 }
 
+/* newest modification time of the fontconfig configuration and font
+ * directories, installing or removing a font touches the latter */
+static uint64_t
+fontconfig_stamp(void)
+{
+	FcStrList *l;
+	FcChar8 *s;
+	struct stat st;
+	uint64_t t = 0;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!(l = i ? FcConfigGetFontDirs(NULL) : FcConfigGetConfigFiles(NULL)))
+			continue;
+		while ((s = FcStrListNext(l)))
+			if (!stat((char *)s, &st) && (uint64_t)st.st_mtime > t)
+				t = st.st_mtime;
+		FcStrListDone(l);
+	}
+	return t;
+}
+
+/* identifies the fonts the set was created from, fallbacks are picked
+ * to go with the first one */
+static uint64_t
+fontset_key(Drw *drw)
+{
+	uint64_t h = 14695981039346656037ULL;
+	FcChar8 *name, *p;
+	Fnt *f;
+
+	h = (h ^ FcGetVersion()) * 1099511628211ULL;
+	for (f = drw->fonts; f; f = f->next) {
+		if (f->fallback || !f->pattern || !(name = FcNameUnparse(f->pattern)))
+			continue;
+		for (p = name; *p; p++)
+			h = (h ^ *p) * 1099511628211ULL; /* FNV-1a */
+		h = (h ^ 0xff) * 1099511628211ULL;
+		free(name);
+	}
+	return h;
+}
+
+static int
+cacheentry_cmp(const void *a, const void *b)
+{
+	long x = ((const CacheEntry *)a)->cp, y = ((const CacheEntry *)b)->cp;
+
+	return (x > y) - (x < y);
+}
+
+/* Loads the fallback fonts and the codepoints resolved to them, or to
+ * no font, that drw_fontcache_save() wrote, if fontconfig and the font
+ * set are still the same. Must be called with a fresh font set. */
+void
+drw_fontcache_load(Drw *drw, const char *path)
+{
+	const CacheHeader *hd;
+	const CacheRange *r;
+	const char *names, *end;
+	Fnt *fonts[MAXFALLBACK], *f, *last;
+	FcPattern *pattern;
+	CharFont *g;
+	struct stat st;
+	void *map;
+	size_t n, ncp = 0;
+	uint32_t i;
+	long cp;
+	int fd;
+
+	if (!drw || !drw->fonts || !path || (fd = open(path, O_RDONLY)) < 0)
+		return;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CacheHeader)
+	|| (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+	close(fd);
+	hd = map;
+	r = (const CacheRange *)(hd + 1);
+	end = (const char *)map + st.st_size;
+	if (memcmp(hd->magic, CACHEMAGIC, sizeof(hd->magic))
+	|| hd->nranges > (st.st_size - sizeof(CacheHeader)) / sizeof(CacheRange)
+	|| hd->nfonts > MAXFALLBACK
+	|| hd->key != fontset_key(drw) || hd->stamp != fontconfig_stamp())
+		goto done;
+
+	for (last = drw->fonts; last->next; last = last->next)
+		; /* NOP */
+	names = (const char *)(r + hd->nranges);
+	for (i = 0; i < hd->nfonts; i++) {
+		fonts[i] = NULL;
+		if (names == end || (n = strnlen(names, end - names)) == (size_t)(end - names))
+			continue;
+		/* the pattern was matched already, no fontconfig lookup here */
+		if ((pattern = FcNameParse((FcChar8 *)names))
+		&& (fonts[i] = xfont_create(drw, NULL, pattern))) {
+			fonts[i]->fallback = 1;
+			last = last->next = fonts[i];
+		}
+		names += n + 1;
+	}
+	for (i = 0; i < hd->nranges; i++, r++) {
+		if (r->lo > r->hi || r->hi > 0x10FFFF || r->font >= (int32_t)hd->nfonts
+		|| (ncp += r->hi - r->lo + 1) > CACHEMAXCP)
+			continue;
+		/* skip the codepoints of fonts that failed to load */
+		if ((f = r->font < 0 ? NULL : fonts[r->font]) == NULL && r->font >= 0)
+			continue;
+		for (cp = r->lo; cp <= (long)r->hi; cp++) {
+			if ((g = glyph_slot(drw, cp))->resolved)
+				continue;
+			g->font = f;
+			g->w = ~0U;
+			g->resolved = 1;
+		}
+	}
+done:
+	munmap(map, st.st_size);
+}
+
+/* Writes the fallback fonts and the codepoints resolved to them, or to
+ * no font, so the next drw_fontcache_load() spares fontconfig lookups. */
+void
+drw_fontcache_save(Drw *drw, const char *path)
+{
+	CacheHeader hd;
+	CacheRange rg;
+	CacheEntry *e;
+	CharFont *g;
+	Fnt *f, *fonts[MAXFALLBACK];
+	FcPattern *p;
+	FcChar8 *name;
+	FILE *fp;
+	char tmp[4096], *s;
+	size_t i, n = 0, j;
+	uint32_t nfonts = 0;
+
+	if (!drw || !drw->fonts || !path
+	|| (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+		return;
+	for (f = drw->fonts; f; f = f->next)
+		if (f->fallback && nfonts < MAXFALLBACK)
+			fonts[nfonts++] = f;
+	e = ecalloc(LENGTH(drw->latin) + drw->nglyphs, sizeof(CacheEntry));
+	for (i = 0; i < LENGTH(drw->latin) + drw->glyphsize; i++) {
+		g = i < LENGTH(drw->latin) ? &drw->latin[i] : &drw->glyphs[i - LENGTH(drw->latin)];
+		if (!g->resolved || (g->font && !g->font->fallback))
+			continue;
+		e[n].cp = i < LENGTH(drw->latin) ? (long)i : g->cp;
+		for (e[n].font = -1, j = 0; g->font && j < nfonts; j++)
+			if (fonts[j] == g->font)
+				e[n].font = j;
+		if (!g->font || e[n].font >= 0)
+			n++;
+	}
+	qsort(e, n, sizeof(CacheEntry), cacheentry_cmp);
+
+	/* create the missing directories */
+	for (s = strchr(tmp + 1, '/'); s; s = strchr(s + 1, '/')) {
+		*s = '\0';
+		mkdir(tmp, 0700);
+		*s = '/';
+	}
+	if (!(fp = fopen(tmp, "w"))) {
+		free(e);
+		return;
+	}
+	memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, CACHEMAGIC, sizeof(hd.magic));
+	hd.stamp = fontconfig_stamp();
+	hd.key = fontset_key(drw);
+	hd.nfonts = nfonts;
+	for (i = 0; i < n; i++)
+		hd.nranges += !i || e[i].cp != e[i - 1].cp + 1 || e[i].font != e[i - 1].font;
+	fwrite(&hd, sizeof(hd), 1, fp);
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && e[j].cp == e[j - 1].cp + 1 && e[j].font == e[i].font; j++)
+			; /* NOP */
+		rg.lo = e[i].cp;
+		rg.hi = e[j - 1].cp;
+		rg.font = e[i].font;
+		fwrite(&rg, sizeof(rg), 1, fp);
+	}
+	for (i = 0; i < nfonts; i++) {
+		/* Xft recomputes the charset from the face, it is the bulk of
+		 * the pattern */
+		name = NULL;
+		if ((p = FcPatternDuplicate(fonts[i]->xfont->pattern))) {
+			FcPatternDel(p, FC_CHARSET);
+			FcPatternDel(p, FC_LANG);
+			name = FcNameUnparse(p);
+			FcPatternDestroy(p);
+		}
+		fputs(name ? (char *)name : "", fp);
+		fputc('\0', fp);
+		free(name);
+	}
+	free(e);
+	if (fclose(fp) == EOF || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
 void
 drw_clr_create(Drw *drw, Clr *dest, const char *clrname, float alpha)
 {
@@ -232,8 +657,10 @@ drw_scm_create(Drw *drw, char *clrnames[], const float alphas[], size_t clrcount
 void
 drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw && drw->fonts != set) {
 		drw->fonts = set;
+		glyphcache_flush(drw);
+	}
 }
 
 void
@@ -255,23 +682,88 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
 }
 
+static unsigned long
+texthash(const char *text, size_t *len)
+{
+	unsigned long h;
+
+	for (h = 2166136261UL, *len = 0; text[*len]; (*len)++)
+		h = (h ^ (unsigned char)text[*len]) * 16777619UL; /* FNV-1a */
+	return h;
+}
+
+/* appends the glyphs of s[0..len) to drw->specs, placed from (x, y) on
+ * the way XftDrawStringUtf8() places them */
+static void
+textrun_shape(Drw *drw, Fnt *font, const char *s, int len, int x, int y)
+{
+	XftGlyphFontSpec *specs;
+	XGlyphInfo ext;
+	FcChar32 ucs4;
+	FT_UInt glyph;
+	int n;
+
+	while (len > 0 && (n = FcUtf8ToUcs4((const FcChar8 *)s, &ucs4, len)) > 0) {
+		if (drw->nspecs == drw->specsize) {
+			specs = ecalloc(drw->specsize ? 2 * drw->specsize : 64, sizeof(XftGlyphFontSpec));
+			if (drw->nspecs)
+				memcpy(specs, drw->specs, drw->nspecs * sizeof(XftGlyphFontSpec));
+			free(drw->specs);
+			drw->specs = specs;
+			drw->specsize = drw->specsize ? 2 * drw->specsize : 64;
+		}
+		glyph = XftCharIndex(drw->dpy, font->xfont, ucs4);
+		XftGlyphExtents(drw->dpy, font->xfont, &glyph, 1, &ext);
+		drw->specs[drw->nspecs].font = font->xfont;
+		drw->specs[drw->nspecs].glyph = glyph;
+		drw->specs[drw->nspecs].x = x;
+		drw->specs[drw->nspecs].y = y;
+		drw->nspecs++;
+		x += ext.xOff;
+		s += n;
+		len -= n;
+	}
+}
+
+/* draws glyphs placed relative to (x, y) in one request */
+static void
+textrun_draw(Drw *drw, XftGlyphFontSpec *specs, unsigned int n, int x, int y, int invert)
+{
+	XftDraw *d;
+	unsigned int i;
+
+	if (!n)
+		return;
+	/* the positions are moved in place for the call and back */
+	for (i = 0; i < n; i++) {
+		specs[i].x += x;
+		specs[i].y += y;
+	}
+	d = XftDrawCreate(drw->dpy, drw->drawable, drw->visual, drw->cmap);
+	XftDrawGlyphFontSpec(d, &drw->scheme[invert ? ColBg : ColFg], specs, n);
+	XftDrawDestroy(d);
+	for (i = 0; i < n; i++) {
+		specs[i].x -= x;
+		specs[i].y -= y;
+	}
+}
+
+/* Strings are drawn from their cached glyphs when drawn into the same
+ * room with the same fonts before, else decoded, resolved, shortened to
+ * fit and shaped, and their glyphs cached. */
 int
 drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
 	char buf[1024];
-	int ty;
-	unsigned int ew;
-	XftDraw *d = NULL;
+	int ox = 0;
+	unsigned int ew, rw = 0;
 	Fnt *usedfont, *curfont, *nextfont;
-	size_t i, len;
+	TextRun *run, *lru;
+	unsigned long hash = 0;
+	size_t i, len, textlen = 0;
 	int utf8strlen, utf8charlen, render = x || y || w || h;
 	long utf8codepoint = 0;
-	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
+	const char *utf8str, *whole = text;
 
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
 		return 0;
@@ -281,11 +773,25 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable, drw->visual, drw->cmap);
 		x += lpad;
 		w -= lpad;
+		ox = x;
+		rw = w;
+		hash = texthash(text, &textlen);
+		for (i = 0; i < LENGTH(drw->runs); i++) {
+			run = &drw->runs[i];
+			if (run->text && run->hash == hash && run->len == textlen
+			&& run->w == w && run->h == h && !memcmp(run->text, text, textlen)) {
+				run->used = ++drw->widthclock;
+				textrun_draw(drw, run->specs, run->nspecs, x, y, invert);
+				return x + w;
+			}
+		}
+		drw->nspecs = 0;
 	}
 
+	/* fallback fonts resolved from here on must outlive the string */
+	drw->fontpin = drw->fontclock;
 	usedfont = drw->fonts;
 	while (1) {
 		utf8strlen = 0;
@@ -293,23 +799,14 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		nextfont = NULL;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
-
-			if (!charexists || nextfont)
+			if (!(curfont = glyph_resolve(drw, utf8codepoint)->font))
+				curfont = drw->fonts;
+			if (curfont != usedfont) {
+				nextfont = curfont;
 				break;
-			else
-				charexists = 0;
+			}
+			utf8strlen += utf8charlen;
+			text += utf8charlen;
 		}
 
 		if (utf8strlen) {
@@ -325,63 +822,39 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 					for (i = len; i && i > len - 3; buf[--i] = '.')
 						; /* NOP */
 
-				if (render) {
-					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
-				}
+				if (render)
+					textrun_shape(drw, usedfont, buf, len, x - ox,
+					              (h - usedfont->h) / 2 + usedfont->xfont->ascent);
 				x += ew;
 				w -= ew;
 			}
 		}
 
-		if (!*text) {
+		if (!*text)
 			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
-
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-			FcPatternAddBool(fcpattern, FC_COLOR, FcFalse);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
-			}
-		}
+		usedfont = nextfont;
 	}
-	if (d)
-		XftDrawDestroy(d);
-
-	return x + (render ? w : 0);
+	if (!render)
+		return x;
+
+	textrun_draw(drw, drw->specs, drw->nspecs, ox, y, invert);
+	lru = &drw->runs[0];
+	for (i = 1; i < LENGTH(drw->runs); i++)
+		if (drw->runs[i].used < lru->used)
+			lru = &drw->runs[i];
+	free(lru->text);
+	free(lru->specs);
+	lru->text = ecalloc(textlen + 1, 1);
+	memcpy(lru->text, whole, textlen);
+	lru->specs = ecalloc(MAX(drw->nspecs, 1), sizeof(XftGlyphFontSpec));
+	memcpy(lru->specs, drw->specs, drw->nspecs * sizeof(XftGlyphFontSpec));
+	lru->nspecs = drw->nspecs;
+	lru->hash = hash;
+	lru->len = textlen;
+	lru->w = rw;
+	lru->h = h;
+	lru->used = ++drw->widthclock;
+	return x + w;
 }
 
 void
@@ -391,15 +864,45 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 		return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
 }
 
+/* Xft does not kern, a string is as wide as its advances add up to.
+ * Recently measured strings are looked up whole. */
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	TextWidth *e, *lru;
+	unsigned long h;
+	unsigned int w;
+	size_t i, n, len;
+	long cp;
+
 	if (!drw || !drw->fonts || !text)
 		return 0;
-	return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+	h = texthash(text, &len);
+	drw->fontpin = drw->fontclock;
+	lru = &drw->widths[0];
+	for (i = 0; i < LENGTH(drw->widths); i++) {
+		e = &drw->widths[i];
+		if (e->text && e->hash == h && e->len == len && !memcmp(e->text, text, len)) {
+			e->used = ++drw->widthclock;
+			return e->w;
+		}
+		if (e->used < lru->used)
+			lru = e;
+	}
+	for (w = 0, i = 0; i < len; i += n) {
+		n = utf8decode(text + i, &cp, UTF_SIZ);
+		w += glyph_advance(drw, cp, text + i, n);
+	}
+	free(lru->text);
+	lru->text = ecalloc(len + 1, 1);
+	memcpy(lru->text, text, len);
+	lru->hash = h;
+	lru->len = len;
+	lru->w = w;
+	lru->used = ++drw->widthclock;
+	return w;
 }
 
 void
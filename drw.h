@@ -9,9 +9,34 @@ typedef struct Fnt {
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
+	int fallback;        /* loaded by drw_text() for a missing glyph */
+	unsigned long used;  /* when it last drew a glyph, if fallback */
 	struct Fnt *next;
 } Fnt;
 
+typedef struct {
+	long cp;             /* -1 for a free slot */
+	int resolved;        /* font and w below are only valid if set */
+	Fnt *font;           /* first font having cp, NULL if none has it */
+	unsigned int w;      /* advance, ~0 if not measured yet */
+} CharFont;
+
+typedef struct {
+	unsigned long hash, used;
+	size_t len;
+	char *text;
+	unsigned int w;
+} TextWidth;
+
+typedef struct {
+	unsigned long hash, used;
+	size_t len;
+	char *text;
+	unsigned int w, h;         /* the room it was fitted into */
+	XftGlyphFontSpec *specs;   /* relative to the top left, ellipsis included */
+	unsigned int nspecs;
+} TextRun;
+
 enum { ColFg, ColBg, ColBorder, ColFloat }; /* Clr scheme index */
 typedef XftColor Clr;
 
@@ -27,6 +52,16 @@ typedef struct {
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	unsigned long fontclock, fontpin;
+	/* codepoints resolved to fonts, see glyph_resolve() */
+	CharFont latin[256];        /* U+0000..U+00FF */
+	CharFont *glyphs;           /* the other codepoints, open addressing */
+	unsigned int glyphsize, nglyphs;
+	TextWidth widths[64];       /* LRU of whole strings, see drw_fontset_getwidth() */
+	unsigned long widthclock;
+	TextRun runs[64];           /* LRU of drawn strings, see drw_text() */
+	XftGlyphFontSpec *specs;    /* glyphs of the string being drawn */
+	unsigned int nspecs, specsize;
 } Drw;
 
 /* Drawable abstraction */
@@ -39,6 +74,8 @@ Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
 void drw_fontset_free(Fnt* set);
 unsigned int drw_fontset_getwidth(Drw *drw, const char *text);
 void drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h);
+void drw_fontcache_load(Drw *drw, const char *path);
+void drw_fontcache_save(Drw *drw, const char *path);
 
 /* Colorscheme abstraction */
 void drw_clr_create(Drw *drw, Clr *dest, const char *clrname, float alpha);
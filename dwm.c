@@ -27,19 +27,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#endif /* __linux__ */
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/extensions/sync.h>
 #include <X11/Xproto.h>
 #include <X11/Xresource.h>
 #include <X11/Xutil.h>
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
 #include <X11/Xft/Xft.h>
 #include <X11/Xlib-xcb.h>
 #include <xcb/res.h>
@@ -64,6 +77,7 @@
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw)
 #define TAGMASK                 ((1 << LENGTH(tags)) - 1)
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad)
+#define FNVBASIS                2166136261UL
 #define XRDB_LOAD_COLOR(R,V)    if (XrmGetResource(xrdb, R, NULL, &type, &value) == True) { \
                                   if (value.addr != NULL && strnlen(value.addr, 8) == 7 && value.addr[0] == '#') { \
                                     int i = 1; \
@@ -105,10 +119,23 @@ enum { CurNormal, CurResize, CurMove, CurResizeHorzArrow, CurResizeVertArrow, Cu
 enum { SchemeBar, SchemeTag, SchemeBorder, SchemeSelect, SchemeFocus, SchemeUnfocus }; /* color schemes */
 enum { NetSupported, NetSystemTray, NetSystemTrayOP, NetSystemTrayOrientation, NetSystemTrayVisual,
 	   NetWMName, NetWMState, NetWMFullscreen, NetActiveWindow, NetWMWindowType, NetWMWindowTypeDock,
-	   NetSystemTrayOrientationHorz, NetWMWindowTypeDialog, NetClientList, NetWMCheck, NetLast }; /* EWMH atoms */
+	   NetSystemTrayOrientationHorz, NetWMWindowTypeDialog, NetClientList, NetWMCheck,
+	   NetWMSyncRequest, NetWMSyncRequestCounter, NetLast }; /* EWMH atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { StatEvCoalesced, StatBarCoalesced, StatConfigSkipped, StatLayoutReused,
+       StatRestackSkipped, StatLast }; /* statistics counters */
+enum { WinFree, WinDeleted, WinClient, WinSwallowed,
+       WinTrayIcon, WinBar, WinSyncAlarm }; /* window index entries */
+enum { BarTags = 1 << 0, BarLtSymbol = 1 << 1, BarTabs = 1 << 2,
+       BarStatus = 1 << 3, BarSystray = 1 << 4,
+       BarExposed = 1 << 5 }; /* bar regions, BarExposed: contents lost */
+enum { SegTags, SegGrid, SegLtSymbol, SegTabs, SegTray, SegLast }; /* bar segments */
+enum { TimerStatus, TimerSync, TimerLast }; /* timers */
+enum { PropNetName, PropName, PropTrans, PropClass, PropState, PropType,
+       PropNormalHints, PropHints, PropProtocols, PropSyncCounter,
+       PropLast }; /* properties read in manage() */
 
 typedef union {
 	int i;
@@ -125,6 +152,11 @@ typedef struct {
 	const Arg arg;
 } Button;
 
+typedef struct {
+	int x, w;
+	unsigned long key; /* hash of what the segment shows, see drawbar() */
+} BarSeg;
+
 typedef struct Monitor Monitor;
 typedef struct Client Client;
 struct Client {
@@ -134,6 +166,7 @@ struct Client {
 	int x, y, w, h;
 	int sfx, sfy, sfw, sfh; /* stored float geometry, used on mode revert */
 	int oldx, oldy, oldw, oldh;
+	int srvx, srvy, srvw, srvh, srvbw; /* geometry last sent to the server */
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
 	int bw, oldbw;
 	unsigned int tags;
@@ -142,10 +175,19 @@ struct Client {
 	int floatborderpx;
 	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen, isactfullscreen, isterminal, noswallow;
 	int ignorecfgreqpos, ignorecfgreqsize;
+	int visidx, tileidx; /* positions in the monitor index, -1 if absent */
+	unsigned short tagrank[8 * sizeof(unsigned int)]; /* position among the clients of each of its tags */
+	int stackidx;        /* position in the focus stack, set by presize() */
+	int noshadow;        /* _COMPTON_SHADOW is 0, -1 before shadowfloat() */
+	XSyncCounter synccounter; /* _NET_WM_SYNC_REQUEST_COUNTER, or None */
+	XSyncAlarm syncalarm;
+	int64_t syncvalue;        /* last value asked for */
+	int syncwait, syncdirty;  /* waiting for syncvalue, a configure is held back */
+	struct timespec syncsent;
 	char scratchkey;
 	pid_t pid;
-	Client *next;
-	Client *snext;
+	Client *next, *prev;
+	Client *snext, *sprev;
 	Client *swallowing;
 	Monitor *mon;
 	Window win;
@@ -169,6 +211,37 @@ typedef struct {
 	void (*arrange)(Monitor *);
 } Layout;
 
+enum { RectCascadeX = 1<<0, RectCascadeY = 1<<1, RectFill = 1<<2,
+       RectHide = 1<<3, RectKeep = 1<<4 }; /* Rect flags */
+
+typedef struct {
+	int x, y, w, h; /* client geometry, border excluded */
+	unsigned int flags;
+} Rect;
+
+/* everything a layout function may look at, see layoutargs() */
+typedef struct {
+	int wx, wy, ww, wh;
+	int gappx, bw;
+	int nmaster;
+	float mfact;
+	int ltaxis[3];
+	int nobars, mtopbar;
+	int top, mtop, stop; /* tiled index of the topmost client overall, in master, in stack */
+	int topbw;           /* current border of the topmost client */
+} LayoutArgs;
+
+/* last layout computed for a tag, reused while its inputs are unchanged */
+typedef struct {
+	void (*arrange)(Monitor *);
+	LayoutArgs args;
+	unsigned int n, nvis, size;
+	Window *wins;   /* tiled clients in list order */
+	float *cfsum;
+	Rect *rects;
+	char ltsymbol[16];
+} LayoutMemo;
+
 typedef struct Pertag Pertag;
 struct Monitor {
 	char ltsymbol[16];
@@ -185,12 +258,27 @@ struct Monitor {
 	unsigned int seltags;
 	unsigned int sellt;
 	unsigned int tagset[2];
+	unsigned int bardirty; /* Bar* regions repainted in idle() */
+	BarSeg barsegs[SegLast]; /* what barwin shows */
+	BarSeg *tabsegs;       /* the same for each tab */
+	unsigned int ntabsegs, tabsegsize;
+	int arrangepending;    /* arrange() deferred to idle() */
+	unsigned int showdelta; /* tags whose visibility the pending arrange must apply */
+	int presizepending;    /* hidden tags need to be laid out again, see presize() */
 	int showbar;
     int showebar;
 	int topbar;
-	Client *clients;
+	Client *clients, *ctail;
 	Client *sel;
-	Client *stack;
+	Client *stack, *stail;
+	Client **vis, **tiled, **floating; /* visible clients in list order, see updateindex() */
+	float *cfacts;        /* cfacts[i] is the cfact sum of the first i tiled clients */
+	Rect *rects;          /* layout result for the tiled clients */
+	unsigned int nvis, ntiled, nfloating, ixsize;
+	unsigned int occ, urg; /* tags with clients, with urgent clients */
+	int ixvalid;
+	Window *stackwins;    /* bar and tiled clients as last restacked */
+	unsigned int nstackwins, stacksize;
 	Monitor *next;
 	Window barwin;
     Window ebarwin;
@@ -213,6 +301,40 @@ typedef struct {
 	int floatborderpx;
 } Rule;
 
+typedef struct {
+	xcb_get_property_cookie_t cookies[PropLast];
+#ifdef __linux__
+	xcb_res_query_client_ids_cookie_t pidcookie;
+#endif /* __linux__ */
+	pid_t pid;
+	char name[256];
+	char classbuf[256];
+	char *res_name, *res_class;
+	Window trans;
+	Atom state, wtype;
+	XSizeHints size;
+	XWMHints wmh;
+	int haswmh;
+	XSyncCounter synccounter;
+	Window win;
+} WinProps;
+
+typedef struct {
+	Window win;
+	int type;
+	void *p;
+} WinEntry;
+
+typedef struct {
+	Time frame, period;   /* ms per refresh, ms between updates */
+	Time last;            /* server time of the last update */
+	Window wait;          /* its ConfigureNotify ends the round trip */
+	int srv[5];           /* what the server had of it, see paceprep() */
+	struct timespec sent;
+	XEvent held;          /* motion not acted on yet, see pacenext() */
+	int isheld, flush;
+} Pacer;
+
 typedef struct Systray Systray;
 struct Systray {
 	Window win;
@@ -231,44 +353,56 @@ struct TabGroup {
 };
 
 /* function declarations */
-static void applyrules(Client *c);
+static void applyrules(Client *c, const char *class, const char *instance);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int *bw, int interact);
 static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachabove(Client *c);
+static void attachafter(Client *c, Client *at);
 static void attachaside(Client *c);
 static void attachbelow(Client *c);
 static void attachbottom(Client *c);
 static void attachtop(Client *c);
 static void attachstack(Client *c);
+static void attachstackafter(Client *c, Client *at);
 static void buttonpress(XEvent *e);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
 static void clientmessage(XEvent *e);
+static void coalesce(XEvent *evs, int n);
+static void commitlayout(Monitor *m, int bw);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
 static void copyvalidchars(char *text, char *rawtext);
 static Monitor *createmon(void);
+static void deferarrange(Monitor *m);
+static void deferview(Monitor *m, unsigned int tags);
 static void demoncleaner(const Arg *arg);
 static void destroynotify(XEvent *e);
+static void dumpstats(const Arg *arg);
 static void detach(Client *c);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
 static void dragfact(const Arg *arg);
+static void dragoutlines(Monitor *m);
 static void drawebar(char *text, Monitor *m, int xpos);
+static int barseg(BarSeg *s, int x, int w, unsigned long key);
 static void drawbar(Monitor *m);
-static void drawbars(void);
+static void drawbartags(Monitor *m, int x, unsigned int occ, unsigned int urg, const int *selrank);
 static void drawbartabgroups(Monitor *m, int x, int stw, int passx);
 static void drawbartab(Monitor *m, Client *c, int x, int w, int tabgroup_active);
 static void drawbartaboptionals(Monitor *m, Client *c, int x, int w, int tabgroup_active);
 static void drawtaggrid(Monitor *m, int *x_pos, unsigned int occ);
 static void drawtheme(int x, int s, int status, int theme);
 static void enternotify(XEvent *e);
+static Window evwindow(XEvent *e);
 static void expose(XEvent *e);
 static Client *findbefore(Client *c);
+static void flushbars(void);
+static const char *fontcachepath(void);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
@@ -276,29 +410,51 @@ static void focusstack(const Arg *arg);
 static Atom getatomprop(Client *c, Atom prop);
 static int getdwmblockspid();
 static int getrootptr(int *x, int *y);
-static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
+static xcb_get_property_reply_t *getpropreply(xcb_get_property_cookie_t cookie);
 static unsigned int getsystraywidth();
 static void grabbuttons(Client *c, int focused);
+static unsigned long hashbytes(unsigned long h, const void *p, size_t n);
 static void grabkeys(void);
+static void handlesignal(int sig);
+static void idle(void);
 static void incnmaster(const Arg *arg);
 static void inplacerotate(const Arg *arg);
+static void istatusexpire(void);
 static void keypress(XEvent *e);
 static int fake_signal(void);
 static void killclient(const Arg *arg);
+static int layoutcached(Monitor *m, const LayoutArgs *a, void (*arrange)(Monitor *));
+static void layoutargs(Monitor *m, LayoutArgs *a);
 static void loadxrdb(void);
-static void manage(Window w, XWindowAttributes *wa);
+static void manage(Window w, XWindowAttributes *wa, WinProps *props);
+static void markbar(Monitor *m, unsigned int regions);
+static void markbars(unsigned int regions);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
+static void memoinvalidate(Monitor *m);
+static void memostore(Monitor *m, const LayoutArgs *a, void (*arrange)(Monitor *));
 static void mirrorlayout(const Arg *arg);
 static void monocle(Monitor *m);
+static void monoclelayout(const LayoutArgs *a, unsigned int n, unsigned int nvis, Rect *r, char *ltsym, size_t symlen);
 static void motionnotify(XEvent *e);
 static void moveresize(const Arg *arg);
 static void moveresizeedge(const Arg *arg);
 static void movemouse(const Arg *arg);
+static void movewindow(Client *c, int x, int y);
+static long msince(const struct timespec *t);
 static Client *nexttagged(Client *c);
 static Client *nexttiled(Client *c);
+static void outline(const XRectangle *r, unsigned int n);
+static int pacemotion(Pacer *p, XEvent *ev);
+static void pacenext(Pacer *p, XEvent *ev);
+static Bool pacepending(Display *dpy, XEvent *ev, XPointer arg);
+static void paceprep(Pacer *p, Client *c);
+static void pacesent(Pacer *p, Client *c);
+static void pacestart(Pacer *p, int x, int y);
 static void pop(Client *) __attribute__((unused));
+static void presize(Monitor *m);
+static void presizeclient(Client *c, const Rect *r, int bw);
 static Client *prevc(Client *c, float f);
 static Client *nextc(Client *c, float f);
 static void propertynotify(XEvent *e);
@@ -317,11 +473,18 @@ static int riodraw(Client *c, const char slopstyle[]);
 static void rioposition(Client *c, int x, int y, int w, int h);
 static void rioresize(const Arg *arg);
 static void riospawn(const Arg *arg);
+static void recvprops(WinProps *p);
+static Time refreshperiod(int x, int y);
+static int replytext(xcb_get_property_reply_t *r, char *text, unsigned int size);
 static void rotatelayoutaxis(const Arg *arg);
+static void runpending(void);
+static void runtimers(void);
 static void run(void);
 static void runorraise(const Arg *arg);
 static void scan(void);
 static int sendevent(Window w, Atom proto, int m, long d0, long d1, long d2, long d3, long d4);
+static void sendgeom(Client *c, int x);
+static void sendprops(Window w, WinProps *p);
 static void sendmon(Client *c, Monitor *m);
 static void setclientstate(Client *c, long state);
 static void setfocus(Client *c);
@@ -329,24 +492,35 @@ static void setactfullscreen(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
 static void setgaps(const Arg *arg);
 static void setlayout(const Arg *arg);
+static void setsizehints(Client *c, XSizeHints *size);
+static void settimer(int id, long ms);
 static void setcfact(const Arg *arg);
 static void setmfact(const Arg *arg);
 static void setup(void);
 static void shadowfloat(Client *c);
 static void seturgent(Client *c, int urg);
-static void showhide(Client *c);
-static void sigchld(int unused);
+static void showhide(Monitor *m, unsigned int tags);
+#ifndef __linux__
+static void sigwakeup(int sig);
+#endif /* __linux__ */
 static void sigdwmblocks(const Arg *arg);
 static void spawn(const Arg *arg);
 static pid_t spawncmd(const Arg *arg);
+static FILE *spawnpipe(const char *cmd, pid_t *pid);
 static void spawnscratch(const Arg *arg);
 static int status2dtextlength(char *stext);
 static void switchcol(const Arg *arg);
 static void switchtag(const Arg *arg);
+static void syncdone(Client *c);
+static void syncdrop(Client *c);
+static void syncexpire(void);
+static void syncnotify(XEvent *e);
+static void syncrequest(Client *c);
 static Monitor *systraytomon(Monitor *m);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
 static void tile(Monitor *);
+static void tilelayout(const LayoutArgs *a, const float *cfsum, unsigned int n, Rect *r, char *ltsym, size_t symlen);
 static void togglebar(const Arg *arg);
 static void toggleebar(const Arg *arg);
 static void togglebars(const Arg *arg);
@@ -364,15 +538,26 @@ static void updatebars(void);
 static void updateclientlist(void);
 static int updategeom(void);
 static void updatenumlockmask(void);
+static void setwindowtype(Client *c, Atom state, Atom wtype);
+static void setwmhints(Client *c, XWMHints *wmh);
+static int textprop(XTextProperty *name, char *text, unsigned int size);
 static void updatesizehints(Client *c);
+static void setupevents(void);
 static void updatestatus(void);
 static void updatesystray(void);
 static void updatesystrayicongeom(Client *i, int w, int h);
 static void updatesystrayiconstate(Client *i, XPropertyEvent *ev);
+static void updateindex(Monitor *m);
 static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
+static void waitevents(int timeout);
+static void winadd(Window w, int type, void *p);
+static void windel(Window w, int type);
+static void *winfind(Window w, int type);
+static unsigned int winhash(Window w, int type);
+static void winrehash(void);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
 static Client *wintosystrayicon(Window w);
@@ -389,7 +574,11 @@ static pid_t getparentprocess(pid_t p);
 static int isdescprocess(pid_t p, pid_t c);
 static Client *swallowingclient(Window w);
 static Client *termforwin(const Client *c);
+#ifdef __linux__
+static pid_t winpidreply(xcb_res_query_client_ids_cookie_t cookie);
+#else
 static pid_t winpid(Window w);
+#endif /* __linux__ */
 
 /* variables */
 static Client *prevzoom = NULL;
@@ -403,6 +592,15 @@ static int lrpad;            /* sum of left and right padding for text */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
 static int istatustimer = 0;
+static int istatuspending = 0;
+static int xfd, sigfd = -1, timerfd = -1, pollfd = -1; /* event sources */
+static sigset_t sigmask, origsigmask;
+static const int handledsigs[] = { SIGCHLD, SIGHUP, SIGINT, SIGTERM };
+static struct timespec deadlines[TimerLast];
+static void (*timerfunc[TimerLast])(void) = {
+	[TimerStatus] = istatusexpire,
+	[TimerSync] = syncexpire,
+};
 static int riodimensions[4] = { -1, -1, -1, -1 };
 static pid_t riopid = 0;
 static void (*handler[LASTEvent]) (XEvent *) = {
@@ -425,12 +623,30 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast];
 static Atom wunshadow;
 static int running = 1;
+static int skipenter = 0;
+static int focuspending = 0;
+static WinEntry *wintab; /* open addressing, linear probing */
+static unsigned int wintabsize, wintabused, wintabfill; /* slots, live, live + deleted */
+static int clientlistpending = 0;
+static XEvent evbuf[256];
+static unsigned long stats[StatLast];
+static const char *statnames[StatLast] = {
+	[StatEvCoalesced] = "events coalesced",
+	[StatBarCoalesced] = "bar redraws avoided",
+	[StatConfigSkipped] = "reconfigures skipped",
+	[StatLayoutReused] = "layouts reused",
+	[StatRestackSkipped] = "restacks skipped",
+};
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
 static Drw *drw;
 static Monitor *mons, *selmon;
 static Window root, wmcheckwin;
+static int syncevbase, syncerrbase; /* 0 without the XSync extension */
+static GC outlinegc;
+static XRectangle *outlines; /* currently drawn, see outline() */
+static unsigned int noutlines, outlinessize;
 static xcb_connection_t *xcon;
 
 static Systray *systray = NULL;
@@ -453,6 +669,7 @@ unsigned int dragon;
 
 struct Pertag {
 	int ltaxes[LENGTH(tags) + 1][3];
+	LayoutMemo memo[LENGTH(tags) + 1]; /* last layout of each tag */
 	unsigned int curtag, prevtag; /* current and previous tag */
 	int nmasters[LENGTH(tags) + 1]; /* number of windows in master area */
 	float mfacts[LENGTH(tags) + 1]; /* mfacts per tag */
@@ -460,6 +677,7 @@ struct Pertag {
 	const Layout *ltidxs[LENGTH(tags) + 1][2]; /* matrix of tags and layouts indexes  */
 	int showbars[LENGTH(tags) + 1]; /* display bar for the current tag */
 	int showebars[LENGTH(tags) + 1]; /* display ebar for the current tag */
+	unsigned int nclients[LENGTH(tags)]; /* clients per tag */
 };
 
 /* compile-time check if all tags fit into an unsigned int bit array. */
@@ -467,21 +685,18 @@ struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
 /* function implementations */
 void
-applyrules(Client *c)
+applyrules(Client *c, const char *class, const char *instance)
 {
-	const char *class, *instance;
 	unsigned int i;
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
 
 	/* rule matching */
 	c->isfloating = 0;
 	c->tags = 0;
 	c->scratchkey = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
+	class    = class    ? class    : broken;
+	instance = instance ? instance : broken;
 
 	for (i = 0; i < LENGTH(rules); i++) {
 		r = &rules[i];
@@ -509,10 +724,6 @@ applyrules(Client *c)
 			}
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
 }
@@ -595,10 +806,15 @@ applysizehints(Client *c, int *x, int *y, int *w, int *h, int *bw, int interact)
 void
 arrange(Monitor *m)
 {
-	if (m)
-		showhide(m->stack);
-	else for (m = mons; m; m = m->next)
-		showhide(m->stack);
+	if (m) {
+		m->arrangepending = 0;
+		m->presizepending = 1;
+		showhide(m, ~0);
+	} else for (m = mons; m; m = m->next) {
+		m->arrangepending = 0;
+		m->presizepending = 1;
+		showhide(m, ~0);
+	}
 	if (m) {
 		arrangemon(m);
 		restack(m);
@@ -623,8 +839,7 @@ arrangemon(Monitor *m)
 void
 attach(Client *c)
 {
-	c->next = c->mon->clients;
-	c->mon->clients = c;
+	attachafter(c, NULL);
 }
 
 void
@@ -634,11 +849,26 @@ attachabove(Client *c)
 		attach(c);
 		return;
 	}
+	attachafter(c, c->mon->sel->prev);
+}
 
-	Client *at;
-	for (at = c->mon->clients; at->next != c->mon->sel; at = at->next);
-	c->next = at->next;
-	at->next = c;
+/* links c into its monitor's client list after at, or at the head if at is NULL */
+void
+attachafter(Client *c, Client *at)
+{
+	Monitor *m = c->mon;
+
+	m->ixvalid = 0;
+	c->prev = at;
+	c->next = at ? at->next : m->clients;
+	if (c->next)
+		c->next->prev = c;
+	else
+		m->ctail = c;
+	if (at)
+		at->next = c;
+	else
+		m->clients = c;
 }
 
 void
@@ -648,8 +878,7 @@ attachaside(Client *c) {
 		attach(c);
 		return;
 		}
-	c->next = at->next;
-	at->next = c;
+	attachafter(c, at);
 }
 
 void
@@ -659,20 +888,13 @@ attachbelow(Client *c)
 		attach(c);
 		return;
 	}
-	c->next = c->mon->sel->next;
-	c->mon->sel->next = c;
+	attachafter(c, c->mon->sel);
 }
 
 void
 attachbottom(Client *c)
 {
-	Client *below = c->mon->clients;
-	for (; below && below->next; below = below->next);
-	c->next = NULL;
-	if (below)
-		below->next = c;
-	else
-		c->mon->clients = c;
+	attachafter(c, c->mon->ctail);
 }
 
 void
@@ -685,20 +907,31 @@ attachtop(Client *c)
 	for (n = 1, below = c->mon->clients;
 		below && below->next && (below->isfloating || !ISVISIBLEONTAG(below, c->tags) || n != m->nmaster);
 		n = below->isfloating || !ISVISIBLEONTAG(below, c->tags) ? n + 0 : n + 1, below = below->next);
-	c->next = NULL;
-	if (below) {
-		c->next = below->next;
-		below->next = c;
-	}
-	else
-		c->mon->clients = c;
+	attachafter(c, below);
 }
 
 void
 attachstack(Client *c)
 {
-	c->snext = c->mon->stack;
-	c->mon->stack = c;
+	attachstackafter(c, NULL);
+}
+
+/* links c into its monitor's focus stack after at, or on top if at is NULL */
+void
+attachstackafter(Client *c, Client *at)
+{
+	Monitor *m = c->mon;
+
+	c->sprev = at;
+	c->snext = at ? at->snext : m->stack;
+	if (c->snext)
+		c->snext->sprev = c;
+	else
+		m->stail = c;
+	if (at)
+		at->snext = c;
+	else
+		m->stack = c;
 }
 
 void
@@ -804,6 +1037,7 @@ cleanup(void)
 	size_t i;
 
 	view(&a);
+	runpending();
 	selmon->lt[selmon->sellt] = &foo;
 	for (m = mons; m; m = m->next)
 		while (m->stack)
@@ -827,7 +1061,14 @@ cleanup(void)
 	for (i = 0; i < LENGTH(colors) + 1; i++)
 		free(scheme[i]);
 	XDestroyWindow(dpy, wmcheckwin);
+	XFreeGC(dpy, outlinegc);
+	free(outlines);
+	drw_fontcache_save(drw, fontcachepath());
 	drw_free(drw);
+	close(sigfd);
+	close(timerfd);
+	close(pollfd);
+	free(wintab);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
@@ -837,6 +1078,7 @@ void
 cleanupmon(Monitor *mon)
 {
 	Monitor *m;
+	unsigned int i;
 
 	if (mon == mons)
 		mons = mons->next;
@@ -844,10 +1086,24 @@ cleanupmon(Monitor *mon)
 		for (m = mons; m && m->next != mon; m = m->next);
 		m->next = mon->next;
 	}
+	windel(mon->barwin, WinBar);
+	windel(mon->ebarwin, WinBar);
 	XUnmapWindow(dpy, mon->barwin);
 	XUnmapWindow(dpy, mon->ebarwin);
 	XDestroyWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->ebarwin);
+	free(mon->vis);
+	free(mon->tiled);
+	free(mon->floating);
+	free(mon->cfacts);
+	free(mon->rects);
+	free(mon->stackwins);
+	free(mon->tabsegs);
+	for (i = 0; i <= LENGTH(tags); i++) {
+		free(mon->pertag->memo[i].wins);
+		free(mon->pertag->memo[i].cfsum);
+		free(mon->pertag->memo[i].rects);
+	}
 	free(mon->pertag);
 	free(mon);
 }
@@ -873,10 +1129,12 @@ clientmessage(XEvent *e)
 			/* Clear status bar to avoid artifacts beneath systray icons */
 			drw_rect(drw, 0, 0, selmon->ww, bh, 1, 1);
 			drw_map(drw, selmon->barwin, 0, 0, selmon->ww, bh);
+			markbar(selmon, BarExposed);
 
 			c->mon = selmon;
 			c->next = systray->icons;
 			systray->icons = c;
+			winadd(c->win, WinTrayIcon, c);
 			XGetWindowAttributes(dpy, c->win, &wa);
 			c->x = c->oldx = c->y = c->oldy = 0;
 			c->w = c->oldw = wa.width;
@@ -897,10 +1155,8 @@ clientmessage(XEvent *e)
 			swa.background_pixel  = scheme[SchemeBar][bartheme ? ColFloat : ColBg].pixel;
 			XChangeWindowAttributes(dpy, c->win, CWBackPixel, &swa);
 			sendevent(c->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_EMBEDDED_NOTIFY, 0 , systray->win, XEMBED_EMBEDDED_VERSION);
-			XSync(dpy, False);
 			setclientstate(c, NormalState);
-			drawbar(selmon);
-			updatesystray();
+			markbar(selmon, BarTabs|BarSystray);
 		}
 		return;
 	}
@@ -918,6 +1174,131 @@ clientmessage(XEvent *e)
 	}
 }
 
+void
+coalesce(XEvent *evs, int n)
+{
+	int i, j;
+	Window w;
+	XEvent *e, *l;
+	XConfigureRequestEvent *a, *b;
+
+	/* an event is dropped when a later one of the same kind on the same
+	 * window makes it redundant; structural events on that window in
+	 * between keep both, dropped events get type 0 */
+	for (i = 0; i < n; i++) {
+		e = &evs[i];
+		switch (e->type) {
+		case PropertyNotify:
+		case MotionNotify:
+		case EnterNotify:
+		case ConfigureRequest:
+			break;
+		case Expose:
+			if (e->xexpose.count == 0)
+				break;
+			/* fallthrough */
+		default:
+			continue;
+		}
+		w = evwindow(e);
+		for (j = i + 1; j < n; j++) {
+			l = &evs[j];
+			if (l->type != e->type) {
+				switch (l->type) {
+				case CreateNotify:
+				case DestroyNotify:
+				case UnmapNotify:
+				case MapNotify:
+				case MapRequest:
+				case ReparentNotify:
+				case ConfigureNotify:
+					if (evwindow(l) == w)
+						j = n;
+				}
+				continue;
+			}
+			if (evwindow(l) != w)
+				continue;
+			if (e->type == PropertyNotify
+			&& (l->xproperty.atom != e->xproperty.atom
+			|| l->xproperty.state != e->xproperty.state))
+				continue;
+			if (e->type == EnterNotify
+			&& (l->xcrossing.mode != e->xcrossing.mode
+			|| l->xcrossing.detail != e->xcrossing.detail))
+				continue;
+			if (e->type == Expose && l->xexpose.count != 0)
+				continue;
+			if (e->type == ConfigureRequest) {
+				/* fold the older request into the newer one */
+				a = &e->xconfigurerequest;
+				b = &l->xconfigurerequest;
+				if (!(b->value_mask & CWX))
+					b->x = a->x;
+				if (!(b->value_mask & CWY))
+					b->y = a->y;
+				if (!(b->value_mask & CWWidth))
+					b->width = a->width;
+				if (!(b->value_mask & CWHeight))
+					b->height = a->height;
+				if (!(b->value_mask & CWBorderWidth))
+					b->border_width = a->border_width;
+				if (!(b->value_mask & CWSibling))
+					b->above = a->above;
+				if (!(b->value_mask & CWStackMode))
+					b->detail = a->detail;
+				b->value_mask |= a->value_mask;
+			}
+			e->type = 0;
+			stats[StatEvCoalesced]++;
+			break;
+		}
+	}
+}
+
+/* applies m->rects to the tiled clients. Size hints may leave a client
+ * smaller than its rect, the rest of a cascading column then moves up to
+ * it and the last client of the column takes the slack, as if each client
+ * had been placed after its predecessor's actual geometry.
+ * Hidden clients only have their geometry recorded and stay where they
+ * are; resize() sends it once they come on top. */
+void
+commitlayout(Monitor *m, int bw)
+{
+	unsigned int i;
+	int s = 0;
+	Rect *r;
+	Client *c;
+
+	for (i = 0; i < m->ntiled; i++) {
+		r = &m->rects[i];
+		c = m->tiled[i];
+		if (r->flags & RectKeep)
+			continue;
+		if (r->flags & RectHide) {
+			c->x = r->x; c->y = r->y;
+			c->w = r->w; c->h = r->h;
+			c->bw = bw;
+			continue;
+		}
+		if (r->flags & RectCascadeX) {
+			resize(c, r->x + s, r->y, r->w - (r->flags & RectFill ? s : 0), r->h, bw, 0);
+			s = c->x + WIDTH(c) - (r->x + r->w + 2 * bw);
+		} else if (r->flags & RectCascadeY) {
+			resize(c, r->x, r->y + s, r->w, r->h - (r->flags & RectFill ? s : 0), bw, 0);
+			s = c->y + HEIGHT(c) - (r->y + r->h + 2 * bw);
+		} else
+			resize(c, r->x, r->y, r->w, r->h, bw, 0);
+		if (r->flags & RectFill)
+			s = 0;
+	}
+	for (i = 0; i < m->ntiled; i++) {
+		c = m->tiled[i];
+		if ((m->rects[i].flags & RectHide) && c->srvx + c->srvw + 2 * c->srvbw > 0)
+			movewindow(c, WIDTH(c) * -2, c->y);
+	}
+}
+
 void
 configure(Client *c)
 {
@@ -1002,8 +1383,10 @@ configurerequest(XEvent *e)
 				c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
 			if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight)))
 				configure(c);
-			if (ISVISIBLE(c))
+			if (ISVISIBLE(c)) {
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+				c->srvx = c->x; c->srvy = c->y; c->srvw = c->w; c->srvh = c->h;
+			}
 		} else
 			configure(c);
 	} else {
@@ -1016,7 +1399,6 @@ configurerequest(XEvent *e)
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 	}
-	XSync(dpy, False);
 }
 
 void
@@ -1071,12 +1453,30 @@ createmon(void)
 	return m;
 }
 
+void
+deferarrange(Monitor *m)
+{
+	if (m)
+		deferview(m, ~0);
+	else for (m = mons; m; m = m->next)
+		deferview(m, ~0);
+}
+
+/* defers an arrange that only needs to show or hide the clients on tags */
+void
+deferview(Monitor *m, unsigned int tags)
+{
+	m->arrangepending = 1;
+	m->showdelta |= tags;
+}
+
 void
 demoncleaner(const Arg *arg)
 {
 	/* Clear status bar to avoid artifacts beneath systray icons */
 	drw_rect(drw, 0, 0, selmon->ww, bh, 1, 1);
 	drw_map(drw, selmon->barwin, 0, 0, selmon->ww, bh);
+	markbar(selmon, BarExposed);
 
 	toggleebar(0);
 	togglebar(0);
@@ -1096,7 +1496,7 @@ destroynotify(XEvent *e)
 		unmanage(c, 1);
 	else if (showsystray && (c = wintosystrayicon(ev->window))) {
 		removesystrayicon(c);
-		updatesystray();
+		markbar(systraytomon(NULL), BarSystray);
 	}
 	else if ((c = swallowingclient(ev->window)))
 		unmanage(c->swallowing, 1);
@@ -1105,19 +1505,39 @@ destroynotify(XEvent *e)
 void
 detach(Client *c)
 {
-	Client **tc;
+	Monitor *m = c->mon;
 
-	for (tc = &c->mon->clients; *tc && *tc != c; tc = &(*tc)->next);
-	*tc = c->next;
+	m->ixvalid = 0;
+	if (!c->prev && m->clients != c)
+		return; /* not linked, e.g. already replaced by unswallow() */
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		m->clients = c->next;
+	if (c->next)
+		c->next->prev = c->prev;
+	else
+		m->ctail = c->prev;
+	c->next = c->prev = NULL;
 }
 
 void
 detachstack(Client *c)
 {
-	Client **tc, *t;
+	Monitor *m = c->mon;
+	Client *t;
 
-	for (tc = &c->mon->stack; *tc && *tc != c; tc = &(*tc)->snext);
-	*tc = c->snext;
+	if (c->sprev || m->stack == c) {
+		if (c->sprev)
+			c->sprev->snext = c->snext;
+		else
+			m->stack = c->snext;
+		if (c->snext)
+			c->snext->sprev = c->sprev;
+		else
+			m->stail = c->sprev;
+		c->snext = c->sprev = NULL;
+	}
 
 	if (c == c->mon->sel) {
 		for (t = c->mon->stack; t && !ISVISIBLE(t); t = t->snext);
@@ -1125,6 +1545,33 @@ detachstack(Client *c)
 	}
 }
 
+/* outlines the tiled clients as the current facts would lay them out */
+void
+dragoutlines(Monitor *m)
+{
+	LayoutArgs a;
+	XRectangle *r;
+	unsigned int i, n;
+	char sym[sizeof m->ltsymbol];
+
+	m->ixvalid = 0; /* the cfacts just changed */
+	updateindex(m);
+	layoutargs(m, &a);
+	tilelayout(&a, m->cfacts, m->ntiled, m->rects, sym, sizeof sym);
+	r = ecalloc(m->ntiled + 1, sizeof(XRectangle));
+	for (i = n = 0; i < m->ntiled; i++) {
+		if (m->rects[i].flags & RectHide)
+			continue;
+		r[n].x = m->rects[i].x;
+		r[n].y = m->rects[i].y;
+		r[n].width = m->rects[i].w + 2 * a.bw - 1;
+		r[n].height = m->rects[i].h + 2 * a.bw - 1;
+		n++;
+	}
+	outline(r, n);
+	free(r);
+}
+
 Monitor *
 dirtomon(int dir)
 {
@@ -1152,15 +1599,15 @@ dragfact(const Arg *arg)
 	Monitor *m;
 	m = selmon;
 	XEvent ev;
-	Time lasttime = 0;
+	Pacer pc;
 
 	Client *c, *s, *mn, *mp, *sn, *sp;
 	int gapp = m->gappx;
 
-	for (n = 0, c = s = mn = mp = sn = sp = nexttiled(m->clients); c; c = nexttiled(c->next), n++) {
-		if (n == m->nmaster)
-			s = c;
-	}
+	updateindex(m);
+	n = m->ntiled;
+	mn = mp = sn = sp = m->tiled[0];
+	s = n > m->nmaster ? m->tiled[m->nmaster] : mn;
 
 	if (!n)
 		return;
@@ -1208,7 +1655,7 @@ dragfact(const Arg *arg)
 	if (as == 1 || (ams == 1 && m->ltaxis[0] != m->ltaxis[2] && m->ltaxis[2] != 3)) {
 		int cy_pos = m->wy + gapp;
 		int cx_pos = m->wx + gapp;
-		for(i = 0, c = s; c; c = nexttiled(c->next), i++) {
+		for(i = s->tileidx; (c = m->tiled[i]); i++) {
 			if ((m->ltaxis[2] == 2) ? (ybutt > cy_pos && ybutt < c->y) : (xbutt > cx_pos && xbutt < c->x)) {
 				sn = c;
 				sfactn = c->cfact;
@@ -1225,7 +1672,7 @@ dragfact(const Arg *arg)
 	if (am == 1 || (ams == 1 && m->ltaxis[0] != m->ltaxis[1] && m->ltaxis[1] != 3)) {
 		int cy_pos = m->wy + gapp;
 		int cx_pos = m->wx + gapp;
-		for(i = 0, c = nexttiled(m->clients); i < m->nmaster; c = nexttiled(c->next), i++) {
+		for(i = 0; i < m->nmaster && (c = m->tiled[i]); i++) {
 			if ((m->ltaxis[1] == 2) ? (ybutt > cy_pos && ybutt < c->y) : (xbutt > cx_pos && xbutt < c->x)) {
 				mn = c;
 				mfactn = c->cfact;
@@ -1285,9 +1732,14 @@ dragfact(const Arg *arg)
 		: CurResize]->cursor,
 		CurrentTime) != GrabSuccess)
 		return;
+	pacestart(&pc, xbutt, ybutt);
+	if (dragoutline) {
+		XGrabServer(dpy); /* keeps the XOR outline intact */
+		dragoutlines(m);
+	}
 
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		pacenext(&pc, &ev);
 		switch(ev.type) {
 		case ConfigureRequest:
 		case Expose:
@@ -1295,9 +1747,8 @@ dragfact(const Arg *arg)
 			handler[ev.type](&ev);
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 60))
+			if (!pacemotion(&pc, &ev))
 				continue;
-			lasttime = ev.xmotion.time;
 
 			int diffx = ev.xmotion.x - xold;
 			int diffy = ev.xmotion.y - yold;
@@ -1346,12 +1797,24 @@ dragfact(const Arg *arg)
 					}
 				}
 			}
-			arrange(selmon);
+			if (dragoutline)
+				dragoutlines(m);
+			else {
+				m->ixvalid = 0; /* the cfacts just changed */
+				paceprep(&pc, as == 2 ? sn : mn);
+				arrange(selmon);
+				pacesent(&pc, as == 2 ? sn : mn);
+			}
 			xold = ev.xmotion.x;
 			yold = ev.xmotion.y;
 			break;
 		}
 	} while (ev.type != ButtonRelease);
+	if (dragoutline) {
+		outline(NULL, 0);
+		XUngrabServer(dpy);
+		arrange(selmon);
+	}
 
 	XUngrabPointer(dpy, CurrentTime);
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
@@ -1367,85 +1830,110 @@ dragfact(const Arg *arg)
 	}
 }
 
+/* records what bar segment s shows, tells whether it must be repainted */
+int
+barseg(BarSeg *s, int x, int w, unsigned long key)
+{
+	if (s->x == x && s->w == w && s->key == key)
+		return 0;
+	s->x = x;
+	s->w = w;
+	s->key = key;
+	return 1;
+}
+
+/* paints and copies the segments whose content key changed, the
+ * others are still on barwin */
 void
 drawbar(Monitor *m)
 {
-	int indn;
+	int selrank[LENGTH(tags)];
 	int w, x = 0, stw = 0;
-	unsigned int i, occ = 0, urg = 0;
+	unsigned int i, occ, urg, tagset;
+	unsigned long key;
 	Client *c;
 
 	if (showsystray && m == systraytomon(m))
 		stw = getsystraywidth();
 
-	for (c = m->clients; c; c = c->next) {
-		occ |= c->tags == 255 ? 0 : c->tags;
-		if (c->isurgent)
-			urg |= c->tags;
+	updateindex(m);
+	occ = m->occ;
+	urg = m->urg;
+	/* rank of the selected client among each tag's indicators */
+	c = selmon->sel && selmon->sel->mon == m ? selmon->sel : NULL;
+	for (i = 0; i < LENGTH(tags); i++)
+		selrank[i] = c && c->tags & 1 << i ? c->tagrank[i] : -1;
+	if (m->bardirty & BarExposed) {
+		for (i = 0; i < SegLast; i++)
+			m->barsegs[i].w = -1;
+		m->ntabsegs = 0;
+	}
+	/* segments drawn bh - 1 high show this line below them */
+	if (bartheme) {
+		XSetForeground(drw->dpy, drw->gc,scheme[SchemeBar][ColFloat].pixel);
+		XFillRectangle(drw->dpy, drw->drawable, drw->gc, 0, bh - 1, m->ww, 1);
 	}
-	if (drawtagmask & DRAWCLASSICTAGS)
-	for (i = 0; i < LENGTH(tags); i++) {
-		/* do not draw vacant tags */
-		if (!(occ & 1 << i || m->tagset[m->seltags] & 1 << i))
-		continue;
 
-		indn = 0;
-		w = TEXTW(tags[i]);
-		if (m->tagset[m->seltags] & 1 << i) {
-			drw_setscheme(drw, scheme[SchemeSelect]);
-			drw_text(drw, x, 0, w, bh - (bartheme ? 1 : 0), lrpad / 2, tags[i], urg & 1 << i);
-			if (bartheme) {
-				XSetForeground(drw->dpy, drw->gc,scheme[SchemeSelect][ColBorder].pixel);
-				XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, 0, w, 1);
-				XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, 0, 1, bh - 1);
-			}
-		} else {
-			drw_setscheme(drw, scheme[SchemeBar]);
-			drw_setscheme(drw, scheme[LENGTH(colors)]);
-			drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
-			drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
+	tagset = m->tagset[m->seltags];
+	if (drawtagmask & DRAWCLASSICTAGS) {
+		key = hashbytes(FNVBASIS, &tagset, sizeof tagset);
+		key = hashbytes(key, &occ, sizeof occ);
+		key = hashbytes(key, &urg, sizeof urg);
+		for (w = 0, i = 0; i < LENGTH(tags); i++) {
+			if (!(occ & 1 << i || tagset & 1 << i))
+				continue;
+			w += TEXTW(tags[i]);
+			key = hashbytes(key, &m->pertag->nclients[i], sizeof m->pertag->nclients[i]);
+			key = hashbytes(key, &selrank[i], sizeof selrank[i]);
 		}
-		for (c = m->clients; c; c = c->next) {
-			if ((c->tags & (1 << i)) && (indn * 3 + 2 < bh)) {
-				drw_rect(drw, x + 1, indn * 3 + 1, selmon->sel == c ? 5 : 2, 2, 1, urg & 1 << i);
-				indn++;
-			}
+		if (barseg(&m->barsegs[SegTags], x, w, key)) {
+			drawbartags(m, x, occ, urg, selrank);
+			drw_map(drw, m->barwin, x, 0, w, bh);
 		}
 		x += w;
 	}
 	if (drawtagmask & DRAWTAGGRID) {
-		drawtaggrid(m,&x,occ);
+		/* as drawtaggrid() lays it out */
+		w = bh / tagrows * (LENGTH(tags) / tagrows + (LENGTH(tags) % tagrows > 0)) + 1;
+		key = hashbytes(FNVBASIS, &tagset, sizeof tagset);
+		key = hashbytes(key, &occ, sizeof occ);
+		if (!barseg(&m->barsegs[SegGrid], x, w, key))
+			x += w;
+		else {
+			drawtaggrid(m,&x,occ);
+			drw_map(drw, m->barwin, m->barsegs[SegGrid].x, 0, w, bh);
+		}
 	}
 	w = blw = TEXTW(m->ltsymbol);
-	drw_setscheme(drw, scheme[SchemeBar]);
-	drw_setscheme(drw, scheme[LENGTH(colors)]);
-	drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
-	x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
-	drawbartabgroups(m, x, stw, 0);
-	drw_map(drw, m->barwin, 0, 0, m->ww - stw, bh);
-	if (bartheme) {
-		XSetForeground(drw->dpy, drw->gc,scheme[SchemeBar][ColFloat].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, 0, bh - 1, m->ww, 1);
+	if (!barseg(&m->barsegs[SegLtSymbol], x, w, hashbytes(FNVBASIS, m->ltsymbol, strlen(m->ltsymbol))))
+		x += w;
+	else {
+		drw_setscheme(drw, scheme[SchemeBar]);
+		drw_setscheme(drw, scheme[LENGTH(colors)]);
+		drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
+		x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
+		drw_map(drw, m->barwin, x - w, 0, w, bh);
 	}
+	drawbartabgroups(m, x, stw, 0);
 
-	if (showsystray) {
+	if (showsystray && barseg(&m->barsegs[SegTray], m->ww - stw, stw, 0)) {
 		/* Clear status bar to avoid artifacts beneath systray icons */
 		drw_setscheme(drw, scheme[LENGTH(colors)]);
 		drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
 		drw_rect(drw, m->ww - stw, 0, m->ww, bh, 1, 1);
-		drw_map(drw, selmon->barwin, m->ww - stw, 0, m->ww, bh);
-
-		updatesystray();
+		drw_map(drw, m->barwin, m->ww - stw, 0, m->ww, bh);
 	}
 }
 
-void
-drawbars(void)
+/* FNV-1a, keys the bar segments */
+unsigned long
+hashbytes(unsigned long h, const void *p, size_t n)
 {
-	Monitor *m;
+	const unsigned char *s = p;
 
-	for (m = mons; m; m = m->next)
-		drawbar(m);
+	while (n--)
+		h = (h ^ *s++) * 16777619UL;
+	return h;
 }
 
 void
@@ -1602,11 +2090,47 @@ drawebar(char* stext, Monitor *m, int xpos)
 	drw_map(drw, m->ebarwin, 0, 0, m->ww, bh);
 }
 
+void
+drawbartags(Monitor *m, int x, unsigned int occ, unsigned int urg, const int *selrank)
+{
+	int indn, w;
+	unsigned int i;
+
+	for (i = 0; i < LENGTH(tags); i++) {
+		/* do not draw vacant tags */
+		if (!(occ & 1 << i || m->tagset[m->seltags] & 1 << i))
+		continue;
+
+		indn = 0;
+		w = TEXTW(tags[i]);
+		if (m->tagset[m->seltags] & 1 << i) {
+			drw_setscheme(drw, scheme[SchemeSelect]);
+			drw_text(drw, x, 0, w, bh - (bartheme ? 1 : 0), lrpad / 2, tags[i], urg & 1 << i);
+			if (bartheme) {
+				XSetForeground(drw->dpy, drw->gc,scheme[SchemeSelect][ColBorder].pixel);
+				XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, 0, w, 1);
+				XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, 0, 1, bh - 1);
+			}
+		} else {
+			drw_setscheme(drw, scheme[SchemeBar]);
+			drw_setscheme(drw, scheme[LENGTH(colors)]);
+			drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
+			drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
+		}
+		for (; indn < m->pertag->nclients[i] && indn * 3 + 2 < bh; indn++)
+			drw_rect(drw, x + 1, indn * 3 + 1, selrank[i] == indn ? 5 : 2, 2, 1, urg & 1 << i);
+		x += w;
+	}
+}
+
 void
 drawbartabgroups(Monitor *m, int x, int stw, int passx) {
 	Client *c;
 	TabGroup *tg_head = NULL, *tg, *tg2;
-	int tabwidth, tabx, tabgroupwidth, bw;
+	int tabwidth, tabx, tabgroupwidth, bw, all;
+	unsigned int i, n, state[5];
+	unsigned long key;
+	struct { int x, w, gi, dirty; TabGroup *tg; } *tabs;
 
 	if (notileborder == 1 && m->gappx > borderpx)
 		bw = 0;
@@ -1614,9 +2138,12 @@ drawbartabgroups(Monitor *m, int x, int stw, int passx) {
 		bw = borderpx;
 
 	// Calculate
+	updateindex(m);
+	n = m->ntiled;
 	if (NULL != m->lt[m->sellt]->arrange) {
-		for (c = m->clients; c; c = c->next) {
-			if (ISVISIBLE(c) && !c->isfloating && abs(m->ltaxis[0]) != 2 && m->lt[m->sellt]->arrange != monocle) {
+		for (i = 0; i < n; i++) {
+			c = m->tiled[i];
+			if (abs(m->ltaxis[0]) != 2 && m->lt[m->sellt]->arrange != monocle) {
 				for (tg = tg_head; tg && tg->x != c->x - m->mx && tg->next; tg = tg->next);
 				if (!tg || (tg && tg->x != c->x - m->mx)) {
 					tg2 = calloc(1, sizeof(TabGroup));
@@ -1631,8 +2158,8 @@ drawbartabgroups(Monitor *m, int x, int stw, int passx) {
 		tg_head = calloc(1, sizeof(TabGroup));
 		tg_head->end = m->ww;
 	}
-	for (c = m->clients; c; c = c->next) {
-		if (!ISVISIBLE(c) || (c->isfloating)) continue;
+	for (i = 0; i < n; i++) {
+		c = m->tiled[i];
 		for (tg = tg_head; tg && tg->x != c->x - m->mx && tg->next; tg = tg->next);
 		if (m->sel == c) { tg->active = True; }
 		tg->n++;
@@ -1650,21 +2177,76 @@ drawbartabgroups(Monitor *m, int x, int stw, int passx) {
 		}
 	}
 
-	// Draw
-
-	drw_setscheme(drw, scheme[LENGTH(colors)]);
-	drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
-	drw_rect(drw, x, 0, m->ww - stw - x, bh, 1, 1);
-
-	for (c = m->clients; c; c = c->next) {
-		if (!ISVISIBLE(c) || (c->isfloating)) continue;
+	// Place
+	if (n > m->tabsegsize) {
+		free(m->tabsegs);
+		m->tabsegs = ecalloc(n, sizeof(BarSeg));
+		m->tabsegsize = n;
+		m->ntabsegs = 0;
+	}
+	tabs = ecalloc(n + 1, sizeof(*tabs));
+	key = hashbytes(FNVBASIS, &n, sizeof n);
+	for (i = 0; i < n; i++) {
+		c = m->tiled[i];
 		for (tg = tg_head; tg && tg->x != c->x - m->mx && tg->next; tg = tg->next);
 		tabgroupwidth = (MIN(tg->end, m->ww - stw) - MAX(x, tg->start));
 		tabwidth = (tabgroupwidth / tg->n);
 		tabx = MAX(x, tg->start) + (tabwidth * tg->i);
 		tabwidth += (tg->n == tg->i + 1 ?  tabgroupwidth % tg->n : 0);
-		drawbartab(m, c, tabx, tabwidth, tg->active);
-		drawbartaboptionals(m, c, tabx, tabwidth, tg->active);
+		tabs[i].tg = tg;
+		tabs[i].x = tabx;
+		tabs[i].w = tabwidth;
+		tabs[i].gi = tg->i++;
+		key = hashbytes(key, &tabs[i].x, sizeof tabs[i].x);
+		key = hashbytes(key, &tabs[i].w, sizeof tabs[i].w);
+	}
+
+	// Draw
+	if (!passx) {
+		/* a new tab layout clears the area, otherwise only the tabs whose
+		 * key changed are repainted. The selected tab draws a separator
+		 * into its left neighbour, which is keyed on that too, and is
+		 * repainted after it whenever the neighbour is. */
+		if ((all = barseg(&m->barsegs[SegTabs], x, m->ww - stw - x, key))) {
+			for (i = 0; i < n; i++)
+				m->tabsegs[i].w = -1;
+			drw_setscheme(drw, scheme[LENGTH(colors)]);
+			drw->scheme[ColBg] = scheme[SchemeBar][bartheme ? ColFloat : ColBg];
+			drw_rect(drw, x, 0, m->ww - stw - x, bh, 1, 1);
+		} else if (m->ntabsegs < n)
+			for (i = m->ntabsegs; i < n; i++)
+				m->tabsegs[i].w = -1;
+		for (i = 0; i < n; i++) {
+			c = m->tiled[i];
+			state[0] = m->sel == c;
+			state[1] = i + 1 < n && m->tiled[i + 1] == m->sel;
+			state[2] = tabs[i].tg->active;
+			state[3] = m->tagset[m->seltags];
+			state[4] = c->tags;
+			key = hashbytes(FNVBASIS, c->name, strlen(c->name));
+			key = hashbytes(key, state, sizeof state);
+			if (barseg(&m->tabsegs[i], tabs[i].x, tabs[i].w, key) || tabs[i].dirty) {
+				tabs[i].dirty = 1;
+				drawbartab(m, c, tabs[i].x, tabs[i].w, tabs[i].tg->active);
+				drawbartaboptionals(m, c, tabs[i].x, tabs[i].w, tabs[i].tg->active);
+				if (state[1])
+					tabs[i + 1].dirty = 1;
+			}
+		}
+		m->ntabsegs = n;
+		if (all)
+			drw_map(drw, m->barwin, x, 0, m->ww - stw - x, bh);
+		else for (i = 0; i < n; i++)
+			if (tabs[i].dirty)
+				drw_map(drw, m->barwin, tabs[i].x, 0, tabs[i].w, bh);
+	}
+
+	for (i = 0; i < n && passx > 0; i++) {
+		c = m->tiled[i];
+		tg = tabs[i].tg;
+		tg->i = tabs[i].gi;
+		tabx = tabs[i].x;
+		tabwidth = tabs[i].w;
 		if (m ->lt[m->sellt]->arrange == tile && abs(m->ltaxis[0]) != 2) {
 			if (passx > 0 && passx > tabx && passx < tabx + tabwidth) {
 				focus(c);
@@ -1679,8 +2261,8 @@ drawbartabgroups(Monitor *m, int x, int stw, int passx) {
 				restack(selmon);
 			}
 		}
-		tg->i++;
 	}
+	free(tabs);
 	while (tg_head != NULL) { tg = tg_head; tg_head = tg_head->next; free(tg); }
 }
 
@@ -1688,8 +2270,8 @@ void drawbartab(Monitor *m, Client *c, int x, int w, int tabgroup_active) {
 	int n = 0;
 	if (!c) return;
 	if (oneclientdimmer == 1) {
-		Client *s;
-		for(n = 0, s = nexttiled(m->clients); s; s = nexttiled(s->next), n++);
+		updateindex(m);
+		n = m->ntiled;
 		if (n == 1) {
 			drw_setscheme(drw, scheme[LENGTH(colors)]);
 			drw->scheme[ColFg] = scheme[SchemeBar][ColFg];
@@ -1849,6 +2431,15 @@ drawtheme(int x, int s, int status, int theme) {
 	}
 }
 
+void
+dumpstats(const Arg *arg)
+{
+	int i;
+
+	for (i = 0; i < StatLast; i++)
+		fprintf(stderr, "dwm: %s: %lu\n", statnames[i], stats[i]);
+}
+
 void
 enternotify(XEvent *e)
 {
@@ -1868,33 +2459,87 @@ enternotify(XEvent *e)
 	focus(c);
 }
 
+Window
+evwindow(XEvent *e)
+{
+	switch (e->type) {
+	case CreateNotify:     return e->xcreatewindow.window;
+	case DestroyNotify:    return e->xdestroywindow.window;
+	case UnmapNotify:      return e->xunmap.window;
+	case MapNotify:        return e->xmap.window;
+	case MapRequest:       return e->xmaprequest.window;
+	case ReparentNotify:   return e->xreparent.window;
+	case ConfigureNotify:  return e->xconfigure.window;
+	case ConfigureRequest: return e->xconfigurerequest.window;
+	default:               return e->xany.window;
+	}
+}
+
 void
 expose(XEvent *e)
 {
 	Monitor *m;
 	XExposeEvent *ev = &e->xexpose;
 
-	if (ev->count == 0 && (m = wintomon(ev->window))) {
-		drawbar(m);
-		drawebar(rawstext, m, 0);
-		if (showsystray && m == selmon)
-			updatesystray();
-	}
+	if (ev->count == 0 && (m = wintomon(ev->window)))
+		markbar(m, BarTags|BarLtSymbol|BarTabs|BarStatus|BarExposed
+			| (showsystray && m == selmon ? BarSystray : 0));
 }
 
+/* the client before c in selmon's list, the last one for no client,
+ * which makes zoom() push a replaced master to the end */
 Client *
 findbefore(Client *c)
 {
-	Client *tmp;
-	if (c == selmon->clients)
+	if (!c)
+		return selmon->ctail;
+	if (c->mon != selmon)
+		return NULL;
+	return c->prev;
+}
+
+/* where the fallback fonts of the last session are remembered */
+const char *
+fontcachepath(void)
+{
+	static char path[4096];
+	const char *dir;
+
+	if ((dir = getenv("XDG_CACHE_HOME")) && *dir)
+		snprintf(path, sizeof(path), "%s/dwm/fonts", dir);
+	else if ((dir = getenv("HOME")) && *dir)
+		snprintf(path, sizeof(path), "%s/.cache/dwm/fonts", dir);
+	else
 		return NULL;
-	for (tmp = selmon->clients; tmp && tmp->next != c; tmp = tmp->next);
-	return tmp;
+	return path;
+}
+
+void
+flushbars(void)
+{
+	Monitor *m;
+	int tray = 0;
+
+	for (m = mons; m; m = m->next) {
+		if (m->bardirty & (BarTags|BarLtSymbol|BarTabs|BarExposed)) {
+			drawbar(m);
+			/* the tray sits on top of the bar */
+			tray = showsystray;
+		}
+		if (m->bardirty & BarStatus)
+			drawebar(rawstext, m, 0);
+		if (m->bardirty & BarSystray)
+			tray = 1;
+		m->bardirty = 0;
+	}
+	if (tray)
+		updatesystray();
 }
 
 void
 focus(Client *c)
 {
+	focuspending = 0;
 	if (!c || !ISVISIBLE(c))
 		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
 	if (selmon->sel && selmon->sel != c)
@@ -1915,11 +2560,12 @@ focus(Client *c)
 		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
 	selmon->sel = c;
-	if (selmon->lt[selmon->sellt]->arrange == tile)
+	/* a pending arrange() will lay out for the new selection anyway */
+	if (selmon->lt[selmon->sellt]->arrange == tile && !selmon->arrangepending)
 		arrangemon(selmon);
-	if (selmon->lt[selmon->sellt]->arrange == monocle)
+	if (selmon->lt[selmon->sellt]->arrange == monocle && !selmon->arrangepending)
 		arrangemon(selmon);
-	drawbars();
+	markbars(BarTags|BarTabs);
 }
 
 /* there are some broken focus acquiring clients needing extra handling */
@@ -1953,7 +2599,11 @@ focusstack(const Arg *arg)
 
 	if (!selmon->sel)
 		return;
-	if (arg->i > 0) {
+	updateindex(selmon);
+	if (selmon->sel->visidx >= 0) {
+		/* step through the visible clients in list order, wrapping around */
+		c = selmon->vis[(selmon->sel->visidx + (arg->i > 0 ? 1 : selmon->nvis - 1)) % selmon->nvis];
+	} else if (arg->i > 0) {
 		for (c = selmon->sel->next; c && !ISVISIBLE(c); c = c->next);
 		if (!c)
 			for (c = selmon->clients; c && !ISVISIBLE(c); c = c->next);
@@ -1999,11 +2649,15 @@ getatomprop(Client *c, Atom prop)
 int
 getdwmblockspid()
 {
-	char buf[16];
-	FILE *fp = popen("pidof -s dwmblocks", "r");
+	char buf[16] = {0};
+	pid_t child;
+	FILE *fp = spawnpipe("pidof -s dwmblocks", &child);
+	if (!fp)
+		return -1;
 	if (fgets(buf, sizeof(buf), fp));
 	pid_t pid = strtoul(buf, NULL, 10);
-	pclose(fp);
+	fclose(fp);
+	waitpid(child, NULL, 0);
 	dwmblockspid = pid;
 	return pid != 0 ? 0 : -1;
 }
@@ -2018,24 +2672,6 @@ getrootptr(int *x, int *y)
 	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
-long
-getstate(Window w)
-{
-	int format;
-	long result = -1;
-	unsigned char *p = NULL;
-	unsigned long n, extra;
-	Atom real;
-
-	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, False, wmatom[WMState],
-		&real, &format, &n, &extra, (unsigned char **)&p) != Success)
-		return -1;
-	if (n != 0)
-		result = *p;
-	XFree(p);
-	return result;
-}
-
 unsigned int
 getsystraywidth()
 {
@@ -2046,11 +2682,20 @@ getsystraywidth()
 	return w ? w + systrayspacing : 0;
 }
 
+xcb_get_property_reply_t *
+getpropreply(xcb_get_property_cookie_t cookie)
+{
+	xcb_generic_error_t *e = NULL;
+	xcb_get_property_reply_t *r;
+
+	r = xcb_get_property_reply(xcon, cookie, &e);
+	free(e);
+	return r;
+}
+
 int
 gettextprop(Window w, Atom atom, char *text, unsigned int size)
 {
-	char **list = NULL;
-	int n;
 	XTextProperty name;
 
 	if (!text || size == 0)
@@ -2058,15 +2703,7 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 	text[0] = '\0';
 	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems)
 		return 0;
-	if (name.encoding == XA_STRING)
-		strncpy(text, (char *)name.value, size - 1);
-	else {
-		if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) {
-			strncpy(text, *list, size - 1);
-			XFreeStringList(list);
-		}
-	}
-	text[size - 1] = '\0';
+	textprop(&name, text, size);
 	XFree(name.value);
 	return 1;
 }
@@ -2110,13 +2747,46 @@ grabkeys(void)
 	}
 }
 
+void
+handlesignal(int sig)
+{
+	switch (sig) {
+	case SIGCHLD:
+		while (0 < waitpid(-1, NULL, WNOHANG));
+		break;
+	default:
+		running = 0;
+	}
+}
+
+void
+idle(void)
+{
+	XEvent ev;
+	Monitor *m;
+
+	runpending();
+	if (presizehidden)
+		for (m = mons; m; m = m->next)
+			if (m->presizepending)
+				presize(m);
+	flushbars();
+	if (skipenter) {
+		/* one round trip for all restacks of this burst */
+		XSync(dpy, False);
+		while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+		skipenter = 0;
+	} else
+		XFlush(dpy);
+}
+
 void
 incnmaster(const Arg *arg)
 {
 	unsigned int n;
-	Client *c;
 
-	for(n = 0, c = nexttiled(selmon->clients); c; c = nexttiled(c->next), n++);
+	updateindex(selmon);
+	n = selmon->ntiled;
 	if(!arg || !selmon->lt[selmon->sellt]->arrange || selmon->nmaster + arg->i < 1 || selmon->nmaster + arg->i > n)
 		return;
 	selmon->nmaster = selmon->pertag->nmasters[selmon->pertag->curtag] = MAX(selmon->nmaster + arg->i, 0);
@@ -2135,6 +2805,17 @@ isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
 }
 #endif /* XINERAMA */
 
+void
+istatusexpire(void)
+{
+	istatustimer = 0;
+	/* show the regular status held back while the message was up */
+	if (istatuspending) {
+		istatuspending = 0;
+		updatestatus();
+	}
+}
+
 void
 keypress(XEvent *e)
 {
@@ -2192,6 +2873,58 @@ fake_signal(void)
 	return 0;
 }
 
+void
+layoutargs(Monitor *m, LayoutArgs *a)
+{
+	Client *c;
+
+	memset(a, 0, sizeof *a); /* compared with memcmp() by layoutcached() */
+	a->wx = m->wx; a->wy = m->wy; a->ww = m->ww; a->wh = m->wh;
+	a->gappx = m->gappx;
+	a->bw = (notileborder == 1 && m->gappx > borderpx) ? 0 : borderpx;
+	a->nmaster = m->nmaster;
+	a->mfact = m->mfact;
+	a->ltaxis[0] = m->ltaxis[0];
+	a->ltaxis[1] = m->ltaxis[1];
+	a->ltaxis[2] = m->ltaxis[2];
+	a->nobars = abs(m->showbar) + abs(m->showebar) == 0;
+	a->mtopbar = m->topbar;
+	a->top = a->mtop = a->stop = -1;
+	a->topbw = 0;
+	for (c = m->stack; c && (a->mtop < 0 || a->stop < 0); c = c->snext) {
+		if (c->tileidx < 0)
+			continue;
+		if (a->top < 0) {
+			a->top = c->tileidx;
+			a->topbw = c->bw;
+		}
+		if (c->tileidx < m->nmaster && a->mtop < 0)
+			a->mtop = c->tileidx;
+		else if (c->tileidx >= m->nmaster && a->stop < 0)
+			a->stop = c->tileidx;
+	}
+}
+
+/* restores the tiled geometry of the current tag if nothing it was
+ * computed from changed, the commit then skips what the server has */
+int
+layoutcached(Monitor *m, const LayoutArgs *a, void (*arrange)(Monitor *))
+{
+	LayoutMemo *lm = &m->pertag->memo[m->pertag->curtag];
+	unsigned int i;
+
+	if (lm->arrange != arrange || lm->n != m->ntiled || lm->nvis != m->nvis
+	|| memcmp(&lm->args, a, sizeof *a))
+		return 0;
+	for (i = 0; i < lm->n; i++)
+		if (lm->wins[i] != m->tiled[i]->win || lm->cfsum[i + 1] != m->cfacts[i + 1])
+			return 0;
+	memcpy(m->rects, lm->rects, lm->n * sizeof(Rect));
+	memcpy(m->ltsymbol, lm->ltsymbol, sizeof m->ltsymbol);
+	stats[StatLayoutReused]++;
+	return 1;
+}
+
 void
 killclient(const Arg *arg)
 {
@@ -2259,16 +2992,26 @@ loadxrdb()
 }
 
 void
-manage(Window w, XWindowAttributes *wa)
+manage(Window w, XWindowAttributes *wa, WinProps *props)
 {
 	Client *c, *t = NULL, *term = NULL;
-	Window trans = None;
+	Window trans;
 	XWindowChanges wc;
+	WinProps p;
 	int focusclient = 1;
 
+	/* one round trip for everything read below, scan() has them already */
+	if (props)
+		p = *props;
+	else {
+		sendprops(w, &p);
+		recvprops(&p);
+	}
+
 	c = ecalloc(1, sizeof(Client));
 	c->win = w;
-	c->pid = winpid(w);
+	c->pid = p.pid;
+	c->synccounter = syncevbase ? p.synccounter : None;
 	/* geometry */
 	c->floatborderpx = -1;
 	c->floatx = c->floaty = c->floatw = c->floath = -11;
@@ -2278,14 +3021,16 @@ manage(Window w, XWindowAttributes *wa)
 	c->h = c->oldh = wa->height;
 	c->oldbw = wa->border_width;
 	c->cfact = 1.0;
+	c->noshadow = -1;
 
-	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	strcpy(c->name, p.name[0] ? p.name : broken);
+	trans = p.trans;
+	if (trans != None && (t = wintoclient(trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
 	} else {
 		c->mon = selmon;
-		applyrules(c);
+		applyrules(c, p.res_class, p.res_name);
 		term = termforwin(c);
 	}
 
@@ -2334,6 +3079,7 @@ manage(Window w, XWindowAttributes *wa)
 		wc.border_width = c->bw;
 
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
+	c->srvbw = wc.border_width;
 	if(c->isfloating)
 		XSetWindowBorder(dpy, w, scheme[SchemeBorder][ColFloat].pixel);
 	else {
@@ -2343,9 +3089,10 @@ manage(Window w, XWindowAttributes *wa)
 			XSetWindowBorder(dpy, w, scheme[SchemeBorder][ColBorder].pixel);
 	}
 	configure(c); /* propagates border_width, if size doesn't change */
-	updatewindowtype(c);
-	updatesizehints(c);
-	updatewmhints(c);
+	setwindowtype(c, p.state, p.wtype);
+	setsizehints(c, &p.size);
+	if (p.haswmh)
+		setwmhints(c, &p.wmh);
 	c->sfx = c->x;
 	c->sfy = c->y;
 	c->sfw = c->w;
@@ -2385,15 +3132,16 @@ manage(Window w, XWindowAttributes *wa)
 		}
 		if (focusclient || !c->mon->sel || !c->mon->stack)
 			attachstack(c);
-		else {
-			c->snext = c->mon->sel->snext;
-			c->mon->sel->snext = c;
-		}
+		else
+			attachstackafter(c, c->mon->sel);
 	}
+	memoinvalidate(c->mon);
+	winadd(w, WinClient, c);
 
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
+	c->srvx = c->x + 2 * sw; c->srvy = c->y; c->srvw = c->w; c->srvh = c->h;
 	setclientstate(c, NormalState);
 	if (focusclient) {
 		if (c->mon == selmon)
@@ -2412,10 +3160,12 @@ manage(Window w, XWindowAttributes *wa)
 		}
 	}
 
-	arrange(c->mon);
+	/* the window is still off screen, arrange it with the rest of
+	 * the burst */
+	deferarrange(c->mon);
 	XMapWindow(dpy, c->win);
 	if (focusclient)
-		focus(NULL);
+		focuspending = 1;
 }
 
 void
@@ -2437,7 +3187,7 @@ maprequest(XEvent *e)
 	Client *i;
 	if (showsystray && (i = wintosystrayicon(ev->window))) {
 		sendevent(i->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_WINDOW_ACTIVATE, 0, systray->win, XEMBED_EMBEDDED_VERSION);
-		updatesystray();
+		markbar(systraytomon(NULL), BarSystray);
 	}
 
 	if (!XGetWindowAttributes(dpy, ev->window, &wa))
@@ -2445,7 +3195,60 @@ maprequest(XEvent *e)
 	if (wa.override_redirect)
 		return;
 	if (!wintoclient(ev->window))
-		manage(ev->window, &wa);
+		manage(ev->window, &wa, NULL);
+}
+
+void
+markbar(Monitor *m, unsigned int regions)
+{
+	/* painted once the event queue is drained */
+	if ((m->bardirty & regions) == regions)
+		stats[StatBarCoalesced]++;
+	m->bardirty |= regions;
+}
+
+void
+markbars(unsigned int regions)
+{
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		markbar(m, regions);
+}
+
+void
+memoinvalidate(Monitor *m)
+{
+	unsigned int i;
+
+	for (i = 0; i <= LENGTH(tags); i++)
+		m->pertag->memo[i].arrange = NULL;
+}
+
+void
+memostore(Monitor *m, const LayoutArgs *a, void (*arrange)(Monitor *))
+{
+	LayoutMemo *lm = &m->pertag->memo[m->pertag->curtag];
+	unsigned int i;
+
+	if (m->ntiled >= lm->size) {
+		free(lm->wins);
+		free(lm->cfsum);
+		free(lm->rects);
+		lm->size = m->ixsize;
+		lm->wins = ecalloc(lm->size, sizeof(Window));
+		lm->cfsum = ecalloc(lm->size + 1, sizeof(float));
+		lm->rects = ecalloc(lm->size, sizeof(Rect));
+	}
+	lm->arrange = arrange;
+	lm->args = *a;
+	lm->n = m->ntiled;
+	lm->nvis = m->nvis;
+	for (i = 0; i < lm->n; i++)
+		lm->wins[i] = m->tiled[i]->win;
+	memcpy(lm->cfsum, m->cfacts, (lm->n + 1) * sizeof(float));
+	memcpy(lm->rects, m->rects, lm->n * sizeof(Rect));
+	memcpy(lm->ltsymbol, m->ltsymbol, sizeof lm->ltsymbol);
 }
 
 void
@@ -2460,26 +3263,36 @@ mirrorlayout(const Arg *arg) {
 void
 monocle(Monitor *m)
 {
-	unsigned int n = 0;
-	Client *c;
+	LayoutArgs a;
 
-	for (c = m->clients; c; c = c->next)
-		if (ISVISIBLE(c))
-			n++;
-	if (n > 0) /* override layout symbol */
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
-	for (c = m->stack; c && (!ISVISIBLE(c) || c->isfloating); c = c->snext);
-	if (c && !c->isfloating) {
-		XMoveWindow(dpy, c->win, m->wx - c->bw, m->wy);
-		if (abs(m->showbar) + abs(m->showebar) == 0)
-			resize(c, m->wx - c->bw, m->wy - c->bw, m->ww, m->wh, 0, 0);
-		else
-			resize(c, m->wx - c->bw, m->wy, m->ww, m->wh - c->bw, 0, 0);
-		c = c->snext;
+	updateindex(m);
+	layoutargs(m, &a);
+	if (!layoutcached(m, &a, monocle)) {
+		monoclelayout(&a, m->ntiled, m->nvis, m->rects, m->ltsymbol, sizeof m->ltsymbol);
+		memostore(m, &a, monocle);
+	}
+	commitlayout(m, 0);
+}
+
+/* only the topmost tiled client is sized, the others are moved out of sight */
+void
+monoclelayout(const LayoutArgs *a, unsigned int n, unsigned int nvis, Rect *r, char *ltsym, size_t symlen)
+{
+	unsigned int i;
+
+	if (nvis > 0) /* override layout symbol */
+		snprintf(ltsym, symlen, "[%d]", nvis);
+	for (i = 0; i < n; i++) {
+		if ((int)i != a->top) {
+			r[i].flags = RectHide | RectKeep;
+			continue;
+		}
+		r[i].x = a->wx - a->topbw;
+		r[i].y = a->nobars ? a->wy - a->topbw : a->wy;
+		r[i].w = a->ww;
+		r[i].h = a->nobars ? a->wh : a->wh - a->topbw;
+		r[i].flags = 0;
 	}
-	for (; c; c = c->snext)
-		if (!c->isfloating && ISVISIBLE(c))
-			XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
 }
 
 void
@@ -2520,20 +3333,24 @@ movemouse(const Arg *arg)
 	Client *c;
 	Monitor *m;
 	XEvent ev;
-	Time lasttime = 0;
+	XRectangle r;
+	Pacer pc;
 
 	if (!(c = selmon->sel))
 		return;
 	restack(selmon);
-	ocx = c->x;
-	ocy = c->y;
+	ocx = nx = c->x;
+	ocy = ny = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
 		None, cursor[CurMove]->cursor, CurrentTime) != GrabSuccess)
 		return;
 	if (!getrootptr(&x, &y))
 		return;
+	pacestart(&pc, x, y);
+	if (dragoutline)
+		XGrabServer(dpy); /* keeps the XOR outline intact */
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		pacenext(&pc, &ev);
 		switch(ev.type) {
 		case ConfigureRequest:
 		case Expose:
@@ -2541,9 +3358,8 @@ movemouse(const Arg *arg)
 			handler[ev.type](&ev);
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 60))
+			if (!pacemotion(&pc, &ev))
 				continue;
-			lasttime = ev.xmotion.time;
 
 			nx = ocx + (ev.xmotion.x - x);
 			ny = ocy + (ev.xmotion.y - y);
@@ -2556,13 +3372,30 @@ movemouse(const Arg *arg)
 			else if (abs((selmon->wy + selmon->wh) - (ny + HEIGHT(c))) < snap)
 				ny = selmon->wy + selmon->wh - HEIGHT(c);
 			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
-			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap))
+			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap)) {
+				outline(NULL, 0);
 				togglefloating(NULL);
-			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
-				resize(c, nx, ny, c->w, c->h, c->bw, 1);
+			}
+			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating) {
+				if (dragoutline) {
+					r.x = nx; r.y = ny;
+					r.width = WIDTH(c) - 1; r.height = HEIGHT(c) - 1;
+					outline(&r, 1);
+				} else {
+					paceprep(&pc, c);
+					resize(c, nx, ny, c->w, c->h, c->bw, 1);
+					pacesent(&pc, c);
+				}
+			}
 			break;
 		}
 	} while (ev.type != ButtonRelease);
+	if (dragoutline) {
+		outline(NULL, 0);
+		XUngrabServer(dpy);
+		if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
+			resize(c, nx, ny, c->w, c->h, c->bw, 1);
+	}
 	XUngrabPointer(dpy, CurrentTime);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
 		sendmon(c, m);
@@ -2571,6 +3404,27 @@ movemouse(const Arg *arg)
 	}
 }
 
+void
+movewindow(Client *c, int x, int y)
+{
+	if (x == c->srvx && y == c->srvy) {
+		stats[StatConfigSkipped]++;
+		return;
+	}
+	c->srvx = x;
+	c->srvy = y;
+	XMoveWindow(dpy, c->win, x, y);
+}
+
+long
+msince(const struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
 void
 moveresize(const Arg *arg) {
 	/* only floating windows can be moved */
@@ -2744,6 +3598,132 @@ nexttiled(Client *c)
 	return c;
 }
 
+/* replaces the drawn outlines by r, XOR drawing erases what it repaints */
+void
+outline(const XRectangle *r, unsigned int n)
+{
+	if (noutlines)
+		XDrawRectangles(dpy, root, outlinegc, outlines, noutlines);
+	if (n > outlinessize) {
+		free(outlines);
+		outlines = ecalloc(n, sizeof(XRectangle));
+		outlinessize = n;
+	}
+	if (n)
+		memcpy(outlines, r, n * sizeof(XRectangle));
+	noutlines = n;
+	if (n)
+		XDrawRectangles(dpy, root, outlinegc, outlines, noutlines);
+}
+
+/* takes the newest queued motion into ev and tells whether the drag
+ * should act on it now, round trips slower than a frame back off */
+int
+pacemotion(Pacer *p, XEvent *ev)
+{
+	XEvent e;
+	long ms;
+	int stop = 0;
+
+	/* motion anywhere in the queue up to the next button event, other
+	 * events left queued by the drag loop must not end the compression */
+	while (XCheckIfEvent(dpy, &e, pacepending, (XPointer)&stop))
+		*ev = e;
+	p->isheld = 0;
+	if (p->flush) {
+		p->flush = 0;
+		return 1;
+	}
+	if (p->wait) {
+		ms = msince(&p->sent);
+		if (XCheckTypedWindowEvent(dpy, p->wait, ConfigureNotify, &e)) {
+			/* the synthetic one from configure() may follow */
+			while (XCheckTypedWindowEvent(dpy, p->wait, ConfigureNotify, &e));
+			if (ms > (long)p->frame)
+				p->period = MIN(p->period * 2, 8 * p->frame);
+			else
+				p->period = MAX(p->period / 2, p->frame);
+			p->wait = None;
+		} else if (ms < 8 * (long)p->frame) {
+			p->held = *ev;
+			p->isheld = 1;
+			return 0;
+		} else { /* lost, or the geometry did not change after all */
+			p->period = MIN(p->period * 2, 8 * p->frame);
+			p->wait = None;
+		}
+	}
+	if (ev->xmotion.time - p->last <= p->period) {
+		p->held = *ev;
+		p->isheld = 1;
+		return 0;
+	}
+	p->last = ev->xmotion.time;
+	return 1;
+}
+
+/* XMaskEvent for the drag loops, a motion held back by pacemotion()
+ * is replayed before the release so the drag ends where the pointer did */
+void
+pacenext(Pacer *p, XEvent *ev)
+{
+	XEvent e;
+
+	/* XMaskEvent() never returns extension events, answers to sync
+	 * requests would wait for the end of the drag */
+	while (syncevbase && XCheckTypedEvent(dpy, syncevbase + XSyncAlarmNotify, &e))
+		syncnotify(&e);
+	XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, ev);
+	if (ev->type == ButtonRelease && p->isheld) {
+		XPutBackEvent(dpy, ev);
+		*ev = p->held;
+		p->isheld = 0;
+		p->flush = 1;
+	}
+}
+
+/* XCheckIfEvent() predicate taking queued motion in order, nothing may
+ * overtake a button press or release */
+Bool
+pacepending(Display *dpy, XEvent *ev, XPointer arg)
+{
+	int *stop = (int *)arg;
+
+	if (ev->type == ButtonPress || ev->type == ButtonRelease)
+		*stop = 1;
+	return !*stop && ev->type == MotionNotify;
+}
+
+/* remembers what the server has of c before an update */
+void
+paceprep(Pacer *p, Client *c)
+{
+	p->srv[0] = c->srvx;
+	p->srv[1] = c->srvy;
+	p->srv[2] = c->srvw;
+	p->srv[3] = c->srvh;
+	p->srv[4] = c->srvbw;
+}
+
+/* starts a round trip if the update since paceprep() reconfigured c */
+void
+pacesent(Pacer *p, Client *c)
+{
+	if (p->srv[0] == c->srvx && p->srv[1] == c->srvy && p->srv[2] == c->srvw
+	&& p->srv[3] == c->srvh && p->srv[4] == c->srvbw)
+		return;
+	p->wait = c->win;
+	clock_gettime(CLOCK_MONOTONIC, &p->sent);
+	XFlush(dpy);
+}
+
+void
+pacestart(Pacer *p, int x, int y)
+{
+	memset(p, 0, sizeof(Pacer));
+	p->frame = p->period = refreshperiod(x, y);
+}
+
 void
 pop(Client *c)
 {
@@ -2753,6 +3733,92 @@ pop(Client *c)
 	arrange(c->mon);
 }
 
+/* lays out every hidden tag of m with its pertag settings and sizes its
+ * clients while they are offscreen, viewing the tag then only moves them */
+void
+presize(Monitor *m)
+{
+	unsigned int i, j, n, t, nbars, cur;
+	const Layout *lt;
+	LayoutArgs a;
+	Client *c, **tc;
+	float *cf;
+	Rect *r;
+	char sym[sizeof m->ltsymbol];
+
+	m->presizepending = 0;
+	updateindex(m);
+	cur = m->tagset[m->seltags];
+	for (n = 0, c = m->stack; c; c = c->snext)
+		c->stackidx = n++;
+	tc = ecalloc(n + 1, sizeof(Client *));
+	cf = ecalloc(n + 1, sizeof(float));
+	r = ecalloc(n + 1, sizeof(Rect));
+	for (t = 0; t < LENGTH(tags); t++) {
+		if (cur & 1 << t || !m->pertag->nclients[t])
+			continue;
+		lt = m->pertag->ltidxs[t + 1][m->pertag->sellts[t + 1]];
+		if (lt->arrange != tile && lt->arrange != monocle)
+			continue;
+		layoutargs(m, &a);
+		a.nmaster = m->pertag->nmasters[t + 1];
+		a.mfact = m->pertag->mfacts[t + 1];
+		for (i = 0; i < 3; i++)
+			a.ltaxis[i] = m->pertag->ltaxes[t + 1][i];
+		nbars = !!m->pertag->showbars[t + 1] + !!m->pertag->showebars[t + 1];
+		a.nobars = nbars == 0;
+		a.wh = m->mh - nbars * bh;
+		a.wy = m->topbar ? m->my + nbars * bh : m->my;
+		for (n = 0, c = m->clients; c; c = c->next)
+			if (c->tags & 1 << t && !c->isfloating) {
+				tc[n++] = c;
+				cf[n] = cf[n - 1] + c->cfact;
+			}
+		if (a.nmaster > n)
+			a.nmaster = n ? n : 1;
+		/* the clients highest in the stack, overall and per area */
+		a.top = a.mtop = a.stop = -1;
+		for (i = 0; i < n; i++) {
+			if (a.top < 0 || tc[i]->stackidx < tc[a.top]->stackidx) {
+				a.top = i;
+				a.topbw = tc[i]->bw;
+			}
+			if ((int)i < a.nmaster) {
+				if (a.mtop < 0 || tc[i]->stackidx < tc[a.mtop]->stackidx)
+					a.mtop = i;
+			} else if (a.stop < 0 || tc[i]->stackidx < tc[a.stop]->stackidx)
+				a.stop = i;
+		}
+		if (lt->arrange == tile)
+			tilelayout(&a, cf, n, r, sym, sizeof sym);
+		else
+			monoclelayout(&a, n, n, r, sym, sizeof sym);
+		/* clients on several hidden tags follow the first of them */
+		for (j = 0; j < n; j++)
+			if (!(tc[j]->tags & cur) && !(tc[j]->tags & ((1 << t) - 1))
+			&& !(r[j].flags & RectKeep))
+				presizeclient(tc[j], &r[j], a.bw);
+	}
+	free(tc);
+	free(cf);
+	free(r);
+}
+
+void
+presizeclient(Client *c, const Rect *r, int bw)
+{
+	int x = r->x, y = r->y, w = r->w, h = r->h;
+
+	applysizehints(c, &x, &y, &w, &h, &bw, 0);
+	c->x = x; c->y = y;
+	c->w = w; c->h = h;
+	c->bw = bw;
+	if (r->flags & RectHide)
+		return; /* stays behind the top client anyway */
+	/* where showhide() hides it, so showing it is a single move */
+	sendgeom(c, WIDTH(c) * -2);
+}
+
 void
 propertynotify(XEvent *e)
 {
@@ -2767,7 +3833,7 @@ propertynotify(XEvent *e)
 		}
 		else
 			updatesystrayiconstate(c, ev);
-		updatesystray();
+		markbar(systraytomon(NULL), BarSystray);
 	}
 
 	if ((ev->window == root) && (ev->atom == XA_WM_NAME)) {
@@ -2780,21 +3846,23 @@ propertynotify(XEvent *e)
 		default: break;
 		case XA_WM_TRANSIENT_FOR:
 			if (!c->isfloating && (XGetTransientForHint(dpy, c->win, &trans)) &&
-				(c->isfloating = (wintoclient(trans)) != NULL))
+				(c->isfloating = (wintoclient(trans)) != NULL)) {
+				c->mon->ixvalid = 0;
 				arrange(c->mon);
+			}
 			break;
 		case XA_WM_NORMAL_HINTS:
 			updatesizehints(c);
 			break;
 		case XA_WM_HINTS:
 			updatewmhints(c);
-			drawbars();
+			markbars(BarTags);
 			break;
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updatetitle(c);
 			if (c == c->mon->sel)
-				drawbar(c->mon);
+				markbar(c->mon, BarTabs);
 		}
 		if (ev->atom == netatom[NetWMWindowType])
 			updatewindowtype(c);
@@ -2812,12 +3880,10 @@ nextc(Client *c, float f) {
 
 static Client *
 prevc(Client *c, float f) {
-	Client *p, *r;
+	Client *p;
 
-	for(p = selmon->clients, r = NULL; c && p && p != c; p = p->next)
-		if((f || !p->isfloating) && ISVISIBLE(p))
-			r = p;
-	return r;
+	for(p = c ? c->prev : NULL; p && !((f || !p->isfloating) && ISVISIBLE(p)); p = p->prev);
+	return p;
 }
 
 static void
@@ -2830,19 +3896,11 @@ pushup(const Arg *arg) {
 	if((c = prevc(sel, arg->f))) {
 		/* attach before c */
 		detach(sel);
-		sel->next = c;
-		if(selmon->clients == c)
-			selmon->clients = sel;
-		else {
-			for(c = selmon->clients; c->next != sel->next; c = c->next);
-			c->next = sel;
-		}
+		attachafter(sel, c->prev);
 	} else {
 		/* move to the end */
-		for(c = sel; c->next; c = c->next);
 		detach(sel);
-		sel->next = NULL;
-		c->next = sel;
+		attachbottom(sel);
 	}
 	focus(sel);
 	arrange(selmon);
@@ -2858,8 +3916,7 @@ pushdown(const Arg *arg) {
 	if((c = nextc(sel->next, arg->f))) {
 		/* attach after c */
 		detach(sel);
-		sel->next = c->next;
-		c->next = sel;
+		attachafter(sel, c);
 	} else {
 		/* move to the front */
 		detach(sel);
@@ -2889,6 +3946,45 @@ recttomon(int x, int y, int w, int h)
 	return r;
 }
 
+/* ms per refresh of the output showing x,y, 1000 / dragrate if unknown */
+Time
+refreshperiod(int x, int y)
+{
+	Time ms = MAX(1000 / MAX(dragrate, 1), 1);
+#ifdef XRANDR
+	int i, j, found = 0;
+	double hz;
+	XRRScreenResources *res;
+	XRRCrtcInfo *ci;
+	XRRModeInfo *mi;
+
+	if (!(res = XRRGetScreenResourcesCurrent(dpy, root)))
+		return ms;
+	for (i = 0; i < res->ncrtc && !found; i++) {
+		if (!(ci = XRRGetCrtcInfo(dpy, res, res->crtcs[i])))
+			continue;
+		if (ci->mode && x >= ci->x && x < ci->x + (int)ci->width
+		&& y >= ci->y && y < ci->y + (int)ci->height)
+			for (j = 0; j < res->nmode && !found; j++) {
+				mi = &res->modes[j];
+				if (mi->id != ci->mode || !mi->hTotal || !mi->vTotal)
+					continue;
+				found = 1;
+				hz = (double)mi->dotClock / ((double)mi->hTotal * mi->vTotal);
+				if (mi->modeFlags & RR_DoubleScan)
+					hz /= 2;
+				if (mi->modeFlags & RR_Interlace)
+					hz *= 2;
+				if (hz >= 1)
+					ms = MAX(1000 / hz, 1);
+			}
+		XRRFreeCrtcInfo(ci);
+	}
+	XRRFreeScreenResources(res);
+#endif /* XRANDR */
+	return ms;
+}
+
 void
 removesystrayicon(Client *i)
 {
@@ -2899,40 +3995,47 @@ removesystrayicon(Client *i)
 	for (ii = &systray->icons; *ii && *ii != i; ii = &(*ii)->next);
 	if (ii)
 		*ii = i->next;
+	windel(i->win, WinTrayIcon);
 	free(i);
 }
 
 void
 replaceclient(Client *old, Client *new)
 {
-	Client *c = NULL;
 	Monitor *mon = old->mon;
 
 	new->mon = mon;
 	new->tags = old->tags;
 	new->isfloating = old->isfloating;
+	mon->ixvalid = 0;
 
 	new->next = old->next;
+	new->prev = old->prev;
 	new->snext = old->snext;
+	new->sprev = old->sprev;
 
-	if (old == mon->clients)
+	if (new->prev)
+		new->prev->next = new;
+	else
 		mon->clients = new;
-	else {
-		for (c = mon->clients; c && c->next != old; c = c->next);
-		c->next = new;
-	}
+	if (new->next)
+		new->next->prev = new;
+	else
+		mon->ctail = new;
 
-	if (old == mon->stack)
+	if (new->sprev)
+		new->sprev->snext = new;
+	else
 		mon->stack = new;
-	else {
-		for (c = mon->stack; c && c->snext != old; c = c->snext);
-		c->snext = new;
-	}
+	if (new->snext)
+		new->snext->sprev = new;
+	else
+		mon->stail = new;
 
-	old->next = NULL;
-	old->snext = NULL;
+	old->next = old->prev = NULL;
+	old->snext = old->sprev = NULL;
 
-	XMoveWindow(dpy, old->win, WIDTH(old) * -2, old->y);
+	movewindow(old, WIDTH(old) * -2, old->y);
 
 	if (ISVISIBLE(new)) {
 		if (new->isfloating)
@@ -2947,25 +4050,23 @@ resize(Client *c, int x, int y, int w, int h, int bw, int interact)
 {
 	if (applysizehints(c, &x, &y, &w, &h, &bw, interact))
 		resizeclient(c, x, y, w, h, bw);
+	else if (c->w != c->srvw || c->h != c->srvh || (!c->isfloating && c->bw != c->srvbw))
+		resizeclient(c, x, y, w, h, bw); /* laid out while out of sight */
+	else if (ISVISIBLE(c))
+		movewindow(c, c->x, c->y);
 }
 
 void
 resizeclient(Client *c, int x, int y, int w, int h, int bw)
 {
-	XWindowChanges wc;
-
-	c->oldx = c->x; c->x = wc.x = x;
-	c->oldy = c->y; c->y = wc.y = y;
-	c->oldw = c->w; c->w = wc.width = w;
-	c->oldh = c->h; c->h = wc.height = h;
-	if (c->isfloating && c->floatborderpx >= 0)
-		wc.border_width = c->floatborderpx;
-	else {
-		c->oldbw = c->bw; c->bw = wc.border_width = bw;
+	c->oldx = c->x; c->x = x;
+	c->oldy = c->y; c->y = y;
+	c->oldw = c->w; c->w = w;
+	c->oldh = c->h; c->h = h;
+	if (!c->isfloating || c->floatborderpx < 0) {
+		c->oldbw = c->bw; c->bw = bw;
 	}
-	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
-	configure(c);
-	XSync(dpy, False);
+	sendgeom(c, c->x);
 }
 
 void
@@ -2980,13 +4081,16 @@ resizemouse(const Arg *arg)
 	int di;
 	unsigned int dui;
 	Window dummy;
-	Time lasttime = 0;
+	XRectangle r;
+	Pacer pc;
 
 	if (!(c = selmon->sel))
 		return;
 	restack(selmon);
 	ocx = c->x;
 	ocy = c->y;
+	nw = c->w;
+	nh = c->h;
 	ocx2 = c->x + c->w;
 	ocy2 = c->y + c->h;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -2996,12 +4100,17 @@ resizemouse(const Arg *arg)
 	       return;
 	horizcorner = nx < c->w / 2;
 	vertcorner = ny < c->h / 2;
+	pacestart(&pc, c->x + nx, c->y + ny);
 	XWarpPointer (dpy, None, c->win, 0, 0, 0, 0,
 		      horizcorner ? (-c->bw) : (c->w + c->bw - 1),
 		      vertcorner ? (-c->bw) : (c->h + c->bw - 1));
+	nx = c->x;
+	ny = c->y;
+	if (dragoutline)
+		XGrabServer(dpy); /* keeps the XOR outline intact */
 
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		pacenext(&pc, &ev);
 		switch(ev.type) {
 		case ConfigureRequest:
 		case Expose:
@@ -3009,9 +4118,8 @@ resizemouse(const Arg *arg)
 			handler[ev.type](&ev);
 			break;
 		case MotionNotify:
-			if ((ev.xmotion.time - lasttime) <= (1000 / 60))
+			if (!pacemotion(&pc, &ev))
 				continue;
-			lasttime = ev.xmotion.time;
 
 			nw = MAX(ev.xmotion.x - ocx - 2 * c->bw + 1, 1);
 			nh = MAX(ev.xmotion.y - ocy - 2 * c->bw + 1, 1);
@@ -3024,14 +4132,31 @@ resizemouse(const Arg *arg)
 			&& c->mon->wy + nh >= selmon->wy && c->mon->wy + nh <= selmon->wy + selmon->wh)
 			{
 				if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
-				&& (abs(nw - c->w) > snap || abs(nh - c->h) > snap))
+				&& (abs(nw - c->w) > snap || abs(nh - c->h) > snap)) {
+					outline(NULL, 0);
 					togglefloating(NULL);
+				}
+			}
+			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating) {
+				if (dragoutline) {
+					r.x = nx; r.y = ny;
+					r.width = nw + 2 * c->bw - 1; r.height = nh + 2 * c->bw - 1;
+					outline(&r, 1);
+				} else {
+					paceprep(&pc, c);
+					resize(c, nx, ny, nw, nh, c->bw, 1);
+					pacesent(&pc, c);
+				}
 			}
-			if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
-				resize(c, nx, ny, nw, nh, c->bw, 1);
 			break;
 		}
 	} while (ev.type != ButtonRelease);
+	if (dragoutline) {
+		outline(NULL, 0);
+		XUngrabServer(dpy);
+		if (!selmon->lt[selmon->sellt]->arrange || c->isfloating)
+			resize(c, nx, ny, nw, nh, c->bw, 1);
+	}
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0,
 		      horizcorner ? (-c->bw) : (c->w + c->bw - 1),
 		      vertcorner ? (-c->bw) : (c->h + c->bw - 1));
@@ -3052,7 +4177,7 @@ resizerequest(XEvent *e)
 
 	if ((i = wintosystrayicon(ev->window))) {
 		updatesystrayicongeom(i, ev->width, ev->height);
-		updatesystray();
+		markbar(systraytomon(NULL), BarSystray);
 	}
 }
 
@@ -3060,27 +4185,47 @@ void
 restack(Monitor *m)
 {
 	Client *c;
-	XEvent ev;
-	XWindowChanges wc;
+	Window *w;
+	unsigned int i, k, n;
 
-	drawbar(m);
+	markbar(m, BarTags|BarTabs);
 	if (!m->sel)
 		return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
 		XRaiseWindow(dpy, m->sel->win);
 	if (m->lt[m->sellt]->arrange) {
-		wc.stack_mode = Below;
-		wc.sibling = m->barwin;
-		for (c = m->stack; c; c = c->snext)
-			if (!c->isfloating && ISVISIBLE(c)) {
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
-				wc.sibling = c->win;
-			}
-	}
+		/* tiled clients go below the bar in focus order, only the part
+		 * that differs from the order restacked last is sent */
+		for (n = 1, c = m->stack; c; c = c->snext)
+			n += !c->isfloating && ISVISIBLE(c);
+		if (n > m->stacksize) {
+			w = ecalloc(n, sizeof(Window));
+			memcpy(w, m->stackwins, m->nstackwins * sizeof(Window));
+			free(m->stackwins);
+			m->stackwins = w;
+			m->stacksize = n;
+		}
+		w = m->stackwins;
+		k = m->nstackwins && w[0] == m->barwin ? n : 0;
+		w[0] = m->barwin;
+		for (i = 1, c = m->stack; c; c = c->snext) {
+			if (c->isfloating || !ISVISIBLE(c))
+				continue;
+			if (k == n && (i >= m->nstackwins || w[i] != c->win))
+				k = i;
+			w[i++] = c->win;
+		}
+		m->nstackwins = n;
+		if (k == n)
+			stats[StatRestackSkipped]++;
+		else
+			XRestackWindows(dpy, w + (k ? k - 1 : 0), n - (k ? k - 1 : 0));
+	} else
+		m->nstackwins = 0; /* raising the selection reorders them */
 	for (c = m->stack; c; c = c->snext)
 		shadowfloat(c);
-    XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	/* crossing events caused by the restack are dropped in idle() */
+	skipenter = 1;
 }
 
 int
@@ -3093,14 +4238,18 @@ riodraw(Client *c, const char slopstyle[])
 	char slopcmd[100] = "slop -f x%xx%yx%wx%hx ";
 	int firstchar = 0;
 	int counter = 0;
+	pid_t pid;
 
 	strcat(slopcmd, slopstyle);
-	FILE *fp = popen(slopcmd, "r");
+	FILE *fp = spawnpipe(slopcmd, &pid);
+	if (!fp)
+		return 0;
 
 	while (fgets(str, 100, fp) != NULL)
 		strcat(strout, str);
 
-	pclose(fp);
+	fclose(fp);
+	waitpid(pid, NULL, 0);
 
 	if (strlen(strout) < 6)
 		return 0;
@@ -3154,7 +4303,7 @@ rioposition(Client *c, int x, int y, int w, int h)
 		resizeclient(c, x, y, w - (c->bw * 2), h - (c->bw * 2), c->bw);
 	else
 		resizeclient(c, x - c->bw, y - c->bw, w, h, c->bw);
-	drawbar(c->mon);
+	markbar(c->mon, BarTabs);
 	arrange(c->mon);
 
 	riodimensions[3] = -1;
@@ -3201,15 +4350,220 @@ rotatelayoutaxis(const Arg *arg) {
 	arrange(selmon);
 }
 
+void
+recvprops(WinProps *p)
+{
+	xcb_get_property_reply_t *r[PropLast];
+	uint32_t *v;
+	char *s;
+	int i, n;
+
+	for (i = 0; i < PropLast; i++)
+		r[i] = getpropreply(p->cookies[i]);
+#ifdef __linux__
+	p->pid = winpidreply(p->pidcookie);
+#else
+	p->pid = winpid(p->win);
+#endif /* __linux__ */
+
+	/* title, as in updatetitle() */
+	if (!replytext(r[PropNetName], p->name, sizeof p->name))
+		replytext(r[PropName], p->name, sizeof p->name);
+
+	/* transient-for, as in XGetTransientForHint() */
+	p->trans = None;
+	if (r[PropTrans] && r[PropTrans]->type == XA_WINDOW && r[PropTrans]->format == 32
+	&& xcb_get_property_value_length(r[PropTrans]) >= 4)
+		p->trans = *(uint32_t *)xcb_get_property_value(r[PropTrans]);
+
+	/* class hint, "instance\0class\0" */
+	p->res_name = p->res_class = NULL;
+	if (r[PropClass] && r[PropClass]->format == 8
+	&& (n = xcb_get_property_value_length(r[PropClass])) > 0) {
+		n = MIN(n, sizeof p->classbuf - 1);
+		memcpy(p->classbuf, xcb_get_property_value(r[PropClass]), n);
+		p->classbuf[n] = '\0';
+		p->res_name = p->classbuf;
+		if ((s = memchr(p->classbuf, '\0', n)) && s + 1 < p->classbuf + n)
+			p->res_class = s + 1;
+	}
+
+	/* first atoms of the window state and type, as in getatomprop() */
+	p->state = p->wtype = None;
+	if (r[PropState] && r[PropState]->type == XA_ATOM
+	&& xcb_get_property_value_length(r[PropState]) >= 4)
+		p->state = *(uint32_t *)xcb_get_property_value(r[PropState]);
+	if (r[PropType] && r[PropType]->type == XA_ATOM
+	&& xcb_get_property_value_length(r[PropType]) >= 4)
+		p->wtype = *(uint32_t *)xcb_get_property_value(r[PropType]);
+
+	/* size hints, as in XGetWMNormalHints() */
+	p->size.flags = PSize;
+	if (r[PropNormalHints] && r[PropNormalHints]->type == XA_WM_SIZE_HINTS
+	&& r[PropNormalHints]->format == 32
+	&& (n = xcb_get_property_value_length(r[PropNormalHints]) / 4) >= 15) {
+		v = xcb_get_property_value(r[PropNormalHints]);
+		p->size.flags = v[0] & (USPosition|USSize|PAllHints);
+		p->size.x = (int32_t)v[1];
+		p->size.y = (int32_t)v[2];
+		p->size.width = (int32_t)v[3];
+		p->size.height = (int32_t)v[4];
+		p->size.min_width = (int32_t)v[5];
+		p->size.min_height = (int32_t)v[6];
+		p->size.max_width = (int32_t)v[7];
+		p->size.max_height = (int32_t)v[8];
+		p->size.width_inc = (int32_t)v[9];
+		p->size.height_inc = (int32_t)v[10];
+		p->size.min_aspect.x = (int32_t)v[11];
+		p->size.min_aspect.y = (int32_t)v[12];
+		p->size.max_aspect.x = (int32_t)v[13];
+		p->size.max_aspect.y = (int32_t)v[14];
+		if (n >= 18) {
+			p->size.base_width = (int32_t)v[15];
+			p->size.base_height = (int32_t)v[16];
+			p->size.win_gravity = (int32_t)v[17];
+			/* not in PAllHints, Xlib only keeps them from a long property */
+			p->size.flags |= v[0] & (PBaseSize|PWinGravity);
+		}
+	}
+
+	/* wm hints, as in XGetWMHints() */
+	p->haswmh = 0;
+	if (r[PropHints] && r[PropHints]->type == XA_WM_HINTS && r[PropHints]->format == 32
+	&& (n = xcb_get_property_value_length(r[PropHints]) / 4) >= 8) {
+		v = xcb_get_property_value(r[PropHints]);
+		p->haswmh = 1;
+		p->wmh.flags = v[0];
+		p->wmh.input = v[1] ? True : False;
+		p->wmh.initial_state = (int32_t)v[2];
+		p->wmh.icon_pixmap = v[3];
+		p->wmh.icon_window = v[4];
+		p->wmh.icon_x = (int32_t)v[5];
+		p->wmh.icon_y = (int32_t)v[6];
+		p->wmh.icon_mask = v[7];
+		if (n >= 9)
+			p->wmh.window_group = v[8];
+		else {
+			p->wmh.window_group = 0;
+			p->wmh.flags &= ~WindowGroupHint;
+		}
+	}
+
+	/* sync counter, only used when the protocol is announced as well */
+	p->synccounter = None;
+	if (r[PropSyncCounter] && r[PropSyncCounter]->type == XA_CARDINAL
+	&& xcb_get_property_value_length(r[PropSyncCounter]) >= 4
+	&& r[PropProtocols] && r[PropProtocols]->type == XA_ATOM) {
+		v = xcb_get_property_value(r[PropProtocols]);
+		for (n = xcb_get_property_value_length(r[PropProtocols]) / 4; n--; )
+			if (v[n] == netatom[NetWMSyncRequest])
+				p->synccounter = *(uint32_t *)xcb_get_property_value(r[PropSyncCounter]);
+	}
+
+	for (i = 0; i < PropLast; i++)
+		free(r[i]);
+}
+
+int
+replytext(xcb_get_property_reply_t *r, char *text, unsigned int size)
+{
+	XTextProperty name;
+
+	text[0] = '\0';
+	if (!r || r->format != 8 || !xcb_get_property_value_length(r))
+		return 0;
+	name.value = xcb_get_property_value(r);
+	name.encoding = r->type;
+	name.format = r->format;
+	name.nitems = xcb_get_property_value_length(r);
+	return textprop(&name, text, size);
+}
+
 void
 run(void)
 {
-	XEvent ev;
+	int i, n;
+	XEvent *ev;
 	/* main event loop */
 	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	while (running) {
+		/* handlers only queue requests; they are sent once the queue
+		 * is drained, reading without flushing to find out */
+		if (!XEventsQueued(dpy, QueuedAfterReading))
+			idle();
+		/* sleep until X, a timer or a signal needs attention, but do
+		 * not let pending X traffic starve the other sources */
+		waitevents(XEventsQueued(dpy, QueuedAfterReading) ? 0 : -1);
+		if (!running || !XEventsQueued(dpy, QueuedAfterReading))
+			continue;
+		/* take what is pending as one batch; key and button presses
+		 * end it since their handlers may read events themselves */
+		n = 0;
+		do {
+			if (XNextEvent(dpy, &evbuf[n]))
+				return;
+			n++;
+		} while (n < LENGTH(evbuf)
+		         && evbuf[n - 1].type != KeyPress && evbuf[n - 1].type != ButtonPress
+		         && XEventsQueued(dpy, QueuedAlready));
+		coalesce(evbuf, n);
+		for (i = 0; i < n && running; i++) {
+			ev = &evbuf[i];
+			/* restack() drops crossing events it caused */
+			if (ev->type == EnterNotify && skipenter)
+				continue;
+			/* bindings act on the current layout and focus */
+			if (ev->type == KeyPress || ev->type == ButtonPress)
+				runpending();
+			if (syncevbase && ev->type == syncevbase + XSyncAlarmNotify)
+				syncnotify(ev);
+			else if (ev->type < LASTEvent && handler[ev->type])
+				handler[ev->type](ev); /* call handler */
+		}
+	}
+}
+
+void
+runpending(void)
+{
+	Monitor *m;
+
+	if (focuspending) {
+		focuspending = 0;
+		focus(NULL);
+	}
+	for (m = mons; m; m = m->next)
+		if (m->arrangepending && m->showdelta == ~0U)
+			arrange(m);
+		else if (m->arrangepending) {
+			m->arrangepending = 0;
+			m->presizepending = 1;
+			showhide(m, m->showdelta);
+			arrangemon(m);
+			restack(m);
+		}
+	if (clientlistpending) {
+		clientlistpending = 0;
+		updateclientlist();
+	}
+}
+
+void
+runtimers(void)
+{
+	int i;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < TimerLast; i++) {
+		if (!deadlines[i].tv_sec && !deadlines[i].tv_nsec)
+			continue;
+		if (deadlines[i].tv_sec > now.tv_sec
+		|| (deadlines[i].tv_sec == now.tv_sec && deadlines[i].tv_nsec > now.tv_nsec))
+			continue;
+		settimer(i, -1);
+		timerfunc[i]();
+	}
 }
 
 void
@@ -3228,6 +4582,7 @@ runorraise(const Arg *arg) {
                 view(&a);
                 focus(c);
                 XRaiseWindow(dpy, c->win);
+                c->mon->nstackwins = 0;
                 return;
             }
         }
@@ -3239,28 +4594,171 @@ runorraise(const Arg *arg) {
 void
 scan(void)
 {
-	unsigned int i, num;
+	unsigned int i, n = 0, num;
+	unsigned int *order;
+	long state;
 	Window d1, d2, *wins = NULL;
-	XWindowAttributes wa;
-
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
-				manage(wins[i], &wa);
+	struct timespec start, end;
+	struct {
+		xcb_get_window_attributes_cookie_t attr;
+		xcb_get_geometry_cookie_t geom;
+		xcb_get_property_cookie_t trans, state;
+		int adopt; /* 0: skip, 1: window, 2: transient */
+		XWindowAttributes wa;
+		WinProps props;
+	} *s;
+	xcb_get_window_attributes_reply_t *ar;
+	xcb_get_geometry_reply_t *gr;
+	xcb_get_property_reply_t *tr, *sr;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num))
+		return;
+	s = ecalloc(num + 1, sizeof(*s));
+	order = ecalloc(num + 1, sizeof(unsigned int));
+
+	/* everything needed to pick the windows in one round trip */
+	for (i = 0; i < num; i++) {
+		s[i].attr = xcb_get_window_attributes(xcon, wins[i]);
+		s[i].geom = xcb_get_geometry(xcon, wins[i]);
+		s[i].trans = xcb_get_property(xcon, 0, wins[i], XA_WM_TRANSIENT_FOR, XA_WINDOW, 0, 1);
+		s[i].state = xcb_get_property(xcon, 0, wins[i], wmatom[WMState], wmatom[WMState], 0, 2);
+	}
+	for (i = 0; i < num; i++) {
+		ar = xcb_get_window_attributes_reply(xcon, s[i].attr, NULL);
+		gr = xcb_get_geometry_reply(xcon, s[i].geom, NULL);
+		tr = getpropreply(s[i].trans);
+		sr = getpropreply(s[i].state);
+		state = sr && sr->format == 32 && xcb_get_property_value_length(sr) >= 4
+			? (long)*(uint32_t *)xcb_get_property_value(sr) : -1;
+		if (ar && gr && !ar->override_redirect
+		&& (ar->map_state == XCB_MAP_STATE_VIEWABLE || state == IconicState)) {
+			s[i].adopt = tr && tr->type == XA_WINDOW ? 2 : 1;
+			s[i].wa.x = gr->x;
+			s[i].wa.y = gr->y;
+			s[i].wa.width = gr->width;
+			s[i].wa.height = gr->height;
+			s[i].wa.border_width = gr->border_width;
+			s[i].wa.map_state = ar->map_state;
 		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
-				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
-				manage(wins[i], &wa);
+		free(ar);
+		free(gr);
+		free(tr);
+		free(sr);
+	}
+
+	/* then the properties manage() reads, transients go last */
+	for (i = 0; i < num; i++)
+		if (s[i].adopt == 1)
+			order[n++] = i;
+	for (i = 0; i < num; i++)
+		if (s[i].adopt == 2)
+			order[n++] = i;
+	for (i = 0; i < n; i++)
+		sendprops(wins[order[i]], &s[order[i]].props);
+	for (i = 0; i < n; i++) {
+		recvprops(&s[order[i]].props);
+		manage(wins[order[i]], &s[order[i]].wa, &s[order[i]].props);
+	}
+	focuspending = 1;
+	runpending();
+
+	free(s);
+	free(order);
+	if (wins)
+		XFree(wins);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "dwm: adopted %u of %u windows in %ld ms\n", n, num,
+		(end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000);
+}
+
+void
+sendprops(Window w, WinProps *p)
+{
+	static const struct { int prop; Atom type; uint32_t len; } req[] = {
+		/* property        type                length in 32 bit units */
+		{ PropNetName,     AnyPropertyType,    64 },
+		{ PropName,        AnyPropertyType,    64 },
+		{ PropTrans,       XA_WINDOW,          1 },
+		{ PropClass,       XA_STRING,          64 },
+		{ PropState,       XA_ATOM,            1 },
+		{ PropType,        XA_ATOM,            1 },
+		{ PropNormalHints, XA_WM_SIZE_HINTS,   18 },
+		{ PropHints,       XA_WM_HINTS,        9 },
+		{ PropProtocols,   XA_ATOM,            16 },
+		{ PropSyncCounter, XA_CARDINAL,        1 },
+	};
+	Atom atoms[PropLast];
+	int i;
+#ifdef __linux__
+	xcb_res_client_id_spec_t spec = { .client = w, .mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID };
+#endif /* __linux__ */
+
+	atoms[PropNetName] = netatom[NetWMName];
+	atoms[PropName] = XA_WM_NAME;
+	atoms[PropTrans] = XA_WM_TRANSIENT_FOR;
+	atoms[PropClass] = XA_WM_CLASS;
+	atoms[PropState] = netatom[NetWMState];
+	atoms[PropType] = netatom[NetWMWindowType];
+	atoms[PropNormalHints] = XA_WM_NORMAL_HINTS;
+	atoms[PropHints] = XA_WM_HINTS;
+	atoms[PropProtocols] = wmatom[WMProtocols];
+	atoms[PropSyncCounter] = netatom[NetWMSyncRequestCounter];
+	p->win = w;
+	for (i = 0; i < LENGTH(req); i++)
+		p->cookies[req[i].prop] = xcb_get_property(xcon, 0, w, atoms[req[i].prop],
+			req[i].type, 0, req[i].len);
+#ifdef __linux__
+	p->pidcookie = xcb_res_query_client_ids(xcon, 1, &spec);
+#endif /* __linux__ */
+}
+
+/* sends the client geometry with its left edge at x, only what the server
+ * does not already have, the synthetic ConfigureNotify makes most clients
+ * relayout and repaint */
+void
+sendgeom(Client *c, int x)
+{
+	XWindowChanges wc;
+	unsigned int mask = 0;
+
+	wc.x = x;
+	wc.y = c->y;
+	wc.width = c->w;
+	wc.height = c->h;
+	if (c->isfloating && c->floatborderpx >= 0)
+		wc.border_width = c->floatborderpx;
+	else
+		wc.border_width = c->bw;
+	mask |= wc.x != c->srvx ? CWX : 0;
+	mask |= wc.y != c->srvy ? CWY : 0;
+	mask |= wc.width != c->srvw ? CWWidth : 0;
+	mask |= wc.height != c->srvh ? CWHeight : 0;
+	mask |= wc.border_width != c->srvbw ? CWBorderWidth : 0;
+	c->syncdirty = 0;
+	if (!mask) {
+		stats[StatConfigSkipped]++;
+		return;
+	}
+	/* a client still painting the last size gets the next one when done */
+	if (c->synccounter && mask & (CWWidth|CWHeight) && c->syncwait) {
+		if (msince(&c->syncsent) < synctimeout) {
+			c->syncdirty = 1;
+			return;
 		}
-		if (wins)
-			XFree(wins);
+		/* timed out, syncexpire() does not run during drags */
+		syncdrop(c);
+		syncdone(c);
 	}
+	if (c->synccounter && mask & (CWWidth|CWHeight))
+		syncrequest(c);
+	c->srvx = wc.x; c->srvy = wc.y;
+	c->srvw = wc.width; c->srvh = wc.height;
+	c->srvbw = wc.border_width;
+	XConfigureWindow(dpy, c->win, mask, &wc);
+	/* an offscreen position is not announced, showing the client is */
+	if (x == c->x)
+		configure(c);
 }
 
 void
@@ -3273,6 +4771,7 @@ sendmon(Client *c, Monitor *m)
 	detachstack(c);
 	c->mon = m;
 	c->tags = m->tagset[m->seltags]; /* assign tags of target monitor */
+	m->ixvalid = 0;
 	switch(attachdirection){
 		case 1:
 			attachabove(c);
@@ -3359,11 +4858,13 @@ setactfullscreen(Client *c)
 		c->isactfullscreen = 1;
 		c->oldstate = c->isfloating;
 		c->isfloating = 1;
+		c->mon->ixvalid = 0;
 		resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh, 0);
 		XRaiseWindow(dpy, c->win);
 	} else if (c->isactfullscreen){
 		c->isactfullscreen = 0;
 		c->isfloating = c->oldstate;
+		c->mon->ixvalid = 0;
 		c->x = c->oldx;
 		c->y = c->oldy;
 		c->w = c->oldw;
@@ -3409,6 +4910,7 @@ setgaps(const Arg *arg)
 			XSetWindowBorder(dpy, c->win, scheme[SchemeBorder][ColBg].pixel);
 		focus(c);
 	}
+	memoinvalidate(selmon);
 	arrange(selmon);
 }
 
@@ -3423,7 +4925,7 @@ setlayout(const Arg *arg)
 	if (selmon->sel)
 		arrange(selmon);
 	else
-		drawbar(selmon);
+		markbar(selmon, BarLtSymbol);
 	arrangemon(selmon);
 }
 
@@ -3441,6 +4943,8 @@ void setcfact(const Arg *arg) {
 	else if(f < 0.25 || f > 4.0)
 		return;
 	c->cfact = f;
+	selmon->ixvalid = 0;
+	memoinvalidate(selmon);
 	arrange(selmon);
 }
 
@@ -3459,15 +4963,57 @@ setmfact(const Arg *arg)
 	arrange(selmon);
 }
 
+void
+settimer(int id, long ms)
+{
+	int i;
+	struct timespec *next = NULL;
+#ifdef __linux__
+	struct itimerspec its = { 0 };
+#endif /* __linux__ */
+
+	/* a negative delay disarms the timer */
+	if (ms < 0)
+		deadlines[id].tv_sec = deadlines[id].tv_nsec = 0;
+	else {
+		clock_gettime(CLOCK_MONOTONIC, &deadlines[id]);
+		deadlines[id].tv_sec += ms / 1000;
+		deadlines[id].tv_nsec += (ms % 1000) * 1000000;
+		if (deadlines[id].tv_nsec >= 1000000000) {
+			deadlines[id].tv_sec++;
+			deadlines[id].tv_nsec -= 1000000000;
+		}
+	}
+#ifdef __linux__
+	/* the timerfd always tracks the earliest deadline */
+	for (i = 0; i < TimerLast; i++) {
+		if (!deadlines[i].tv_sec && !deadlines[i].tv_nsec)
+			continue;
+		if (!next || deadlines[i].tv_sec < next->tv_sec
+		|| (deadlines[i].tv_sec == next->tv_sec && deadlines[i].tv_nsec < next->tv_nsec))
+			next = &deadlines[i];
+	}
+	if (next)
+		its.it_value = *next;
+	timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+#else
+	(void)i;
+	(void)next;
+#endif /* __linux__ */
+}
+
 void
 setup(void)
 {
 	int i;
+	int major, minor;
 	XSetWindowAttributes wa;
+	XGCValues gcv;
 	Atom utf8string;
 
 	/* clean up any zombies immediately */
-	sigchld(0);
+	setupevents();
+	handlesignal(SIGCHLD);
 
 	/* init screen */
 	screen = DefaultScreen(dpy);
@@ -3476,11 +5022,19 @@ setup(void)
 	root = RootWindow(dpy, screen);
 	xinitvisual();
 	drw = drw_create(dpy, screen, root, sw, sh, visual, depth, cmap);
+	gcv.function = GXinvert;
+	gcv.subwindow_mode = IncludeInferiors;
+	gcv.line_width = MAX(borderpx, 2);
+	outlinegc = XCreateGC(dpy, root, GCFunction|GCSubwindowMode|GCLineWidth, &gcv);
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
+	drw_fontcache_load(drw, fontcachepath());
 	lrpad = drw->fonts->h;
 	bh = drw->fonts->h + 2;
 	updategeom();
+	if (!XSyncQueryExtension(dpy, &syncevbase, &syncerrbase)
+	|| !XSyncInitialize(dpy, &major, &minor))
+		syncevbase = syncerrbase = 0;
 	/* init atoms */
 	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
 	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
@@ -3502,6 +5056,8 @@ setup(void)
 	netatom[NetWMWindowTypeDock] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DOCK", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetWMSyncRequest] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST", False);
+	netatom[NetWMSyncRequestCounter] = XInternAtom(dpy, "_NET_WM_SYNC_REQUEST_COUNTER", False);
 	xatom[Manager] = XInternAtom(dpy, "MANAGER", False);
 	xatom[Xembed] = XInternAtom(dpy, "_XEMBED", False);
 	xatom[XembedInfo] = XInternAtom(dpy, "_XEMBED_INFO", False);
@@ -3553,6 +5109,7 @@ seturgent(Client *c, int urg)
 	XWMHints *wmh;
 
 	c->isurgent = urg;
+	c->mon->ixvalid = 0;
 	if (!(wmh = XGetWMHints(dpy, c->win)))
 		return;
 	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
@@ -3563,7 +5120,12 @@ seturgent(Client *c, int urg)
  void
 shadowfloat(Client *c)
 {
-	if (!c->isfloating && selmon->lt[selmon->sellt]->arrange) {
+	int noshadow = !c->isfloating && selmon->lt[selmon->sellt]->arrange;
+
+	if (noshadow == c->noshadow)
+		return;
+	c->noshadow = noshadow;
+	if (noshadow) {
 		unsigned long shadow[] = { 0x00000000 };
 		XChangeProperty(dpy, c->win, wunshadow, XA_CARDINAL, 32, PropModeReplace, (unsigned char *)shadow, 1);
 	} else {
@@ -3572,22 +5134,22 @@ shadowfloat(Client *c)
 }
 
 void
-showhide(Client *c)
+showhide(Monitor *m, unsigned int tags)
 {
-	if (!c)
-		return;
-	if (ISVISIBLE(c)) {
-		/* show clients top down */
-		XMoveWindow(dpy, c->win, c->x, c->y);
-		if (!c->mon->lt[c->mon->sellt]->arrange || c->isfloating)
+	Client *c;
+
+	/* show clients top down, tiled ones are brought back by the layout */
+	for (c = m->stack; c; c = c->snext)
+		if ((c->tags & tags) && ISVISIBLE(c) && (!m->lt[m->sellt]->arrange || c->isfloating)) {
+			movewindow(c, c->x, c->y);
 			resize(c, c->x, c->y, c->w, c->h, c->bw, 0);
 //			resize(c, c->x, c->y, c->w, c->h, borderpx, 0);
-		showhide(c->snext);
-	} else {
-		/* hide clients bottom up */
-		showhide(c->snext);
-		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
-	}
+		}
+	/* hide clients bottom up */
+	for (c = m->stail; c; c = c->sprev)
+		if ((c->tags & tags) && !ISVISIBLE(c))
+			movewindow(c, WIDTH(c) * -2, c->y);
+	m->showdelta = 0;
 }
 void switchtag(const Arg *arg)
 {
@@ -3665,13 +5227,18 @@ void switchtag(const Arg *arg)
     }
 }
 
+#ifndef __linux__
 void
-sigchld(int unused)
+sigwakeup(int sig)
 {
-	if (signal(SIGCHLD, sigchld) == SIG_ERR)
-		die("can't install SIGCHLD handler:");
-	while (0 < waitpid(-1, NULL, WNOHANG));
+	int e = errno;
+	unsigned char c = sig;
+
+	/* the signal is handled in waitevents() */
+	write(sigfd, &c, 1);
+	errno = e;
 }
+#endif /* __linux__ */
 
 void
 sigdwmblocks(const Arg *arg)
@@ -3706,6 +5273,7 @@ spawncmd(const Arg *arg)
 		if (dpy)
 			close(ConnectionNumber(dpy));
 		setsid();
+		sigprocmask(SIG_SETMASK, &origsigmask, NULL);
 		execvp(((char **)arg->v)[0], (char **)arg->v);
 		fprintf(stderr, "dwm: execvp %s", ((char **)arg->v)[0]);
 		perror(" failed");
@@ -3714,6 +5282,38 @@ spawncmd(const Arg *arg)
 	return pid;
 }
 
+/* popen(3) for reading, but the child gets the signals dwm blocks, the
+ * caller closes the stream and waits for pid */
+FILE *
+spawnpipe(const char *cmd, pid_t *pid)
+{
+	FILE *fp;
+	int fds[2];
+
+	if (pipe(fds) == -1)
+		return NULL;
+	if ((*pid = fork()) == 0) {
+		if (dpy)
+			close(ConnectionNumber(dpy));
+		sigprocmask(SIG_SETMASK, &origsigmask, NULL);
+		close(fds[0]);
+		if (fds[1] != STDOUT_FILENO) {
+			dup2(fds[1], STDOUT_FILENO);
+			close(fds[1]);
+		}
+		execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+	if (*pid == -1 || !(fp = fdopen(fds[0], "r"))) {
+		close(fds[0]);
+		if (*pid != -1)
+			waitpid(*pid, NULL, 0);
+		return NULL;
+	}
+	return fp;
+}
+
 int
 swallow(Client *t, Client *c)
 {
@@ -3725,6 +5325,8 @@ swallow(Client *t, Client *c)
 	replaceclient(t, c);
 	c->ignorecfgreqpos = 1;
 	c->swallowing = t;
+	windel(t->win, WinClient);
+	winadd(t->win, WinSwallowed, c);
 
 	return 1;
 }
@@ -3733,6 +5335,8 @@ void
 unswallow(Client *c)
 {
 	replaceclient(c, c->swallowing);
+	windel(c->swallowing->win, WinSwallowed);
+	winadd(c->swallowing->win, WinClient, c->swallowing);
 	c->swallowing = NULL;
 }
 
@@ -3794,25 +5398,18 @@ systraytomon(Monitor *m) {
 void
 switchcol(const Arg *arg)
 {
-	Client *c, *t;
+	Client *c;
 	int col = 0;
-	int i;
 
 	if (!selmon->sel)
 		return;
-	for (i = 0, c = nexttiled(selmon->clients); c ;
-	     c = nexttiled(c->next), i++) {
-		if (c == selmon->sel)
-			col = (i + 1) > selmon->nmaster;
-	}
-	if (i <= selmon->nmaster)
+	updateindex(selmon);
+	if (selmon->sel->tileidx >= 0)
+		col = selmon->sel->tileidx + 1 > selmon->nmaster;
+	if (selmon->ntiled <= selmon->nmaster)
 		return;
 	for (c = selmon->stack; c; c = c->snext) {
-		if (!ISVISIBLE(c))
-			continue;
-		for (i = 0, t = nexttiled(selmon->clients); t && t != c;
-		     t = nexttiled(t->next), i++);
-		if (t && (i + 1 > selmon->nmaster) != col) {
+		if (c->tileidx >= 0 && (c->tileidx + 1 > selmon->nmaster) != col) {
 			focus(c);
 			restack(selmon);
 			break;
@@ -3826,6 +5423,7 @@ void spawnscratch(const Arg *arg)
 		if (dpy)
 			close(ConnectionNumber(dpy));
 		setsid();
+		sigprocmask(SIG_SETMASK, &origsigmask, NULL);
 		execvp(((char **)arg->v)[1], ((char **)arg->v)+1);
 		fprintf(stderr, "dwm: execvp %s", ((char **)arg->v)[1]);
 		perror(" failed");
@@ -3833,11 +5431,109 @@ void spawnscratch(const Arg *arg)
 	}
 }
 
+/* the client painted syncvalue or gave up on it, sends what was held back */
+void
+syncdone(Client *c)
+{
+	c->syncwait = 0;
+	/* hidden meanwhile, showing it again resends the size */
+	if (c->syncdirty && ISVISIBLE(c))
+		sendgeom(c, c->x);
+	c->syncdirty = 0;
+}
+
+/* stops using _NET_WM_SYNC_REQUEST with c */
+void
+syncdrop(Client *c)
+{
+	if (c->syncalarm) {
+		windel(c->syncalarm, WinSyncAlarm);
+		XSyncDestroyAlarm(dpy, c->syncalarm);
+	}
+	c->syncalarm = c->synccounter = None;
+}
+
+/* releases clients that did not answer their sync request in time, a
+ * client that never updates its counter would otherwise be held back on
+ * every resize, so it is no longer asked */
+void
+syncexpire(void)
+{
+	Client *c;
+	Monitor *m;
+	long ms, next = -1;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			if (!c->syncwait)
+				continue;
+			if ((ms = msince(&c->syncsent)) >= synctimeout) {
+				syncdrop(c);
+				syncdone(c);
+			}
+			else if (next < 0 || synctimeout - ms < next)
+				next = synctimeout - ms;
+		}
+	if (next >= 0)
+		settimer(TimerSync, next);
+}
+
+void
+syncnotify(XEvent *e)
+{
+	XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)e;
+	Client *c;
+	int64_t v;
+
+	if (!(c = winfind(ev->alarm, WinSyncAlarm)))
+		return;
+	if (ev->state == XSyncAlarmDestroyed) {
+		/* the counter is gone, so is the protocol */
+		syncdrop(c);
+		if (c->syncwait)
+			syncdone(c);
+		return;
+	}
+	v = (int64_t)XSyncValueHigh32(ev->counter_value) << 32
+	  | XSyncValueLow32(ev->counter_value);
+	if (c->syncwait && v >= c->syncvalue)
+		syncdone(c);
+}
+
+/* asks the client to report when it painted the configure sent next */
+void
+syncrequest(Client *c)
+{
+	XSyncAlarmAttributes aa;
+
+	c->syncvalue++;
+	XSyncIntsToValue(&aa.trigger.wait_value, c->syncvalue & 0xffffffff,
+		(int)(c->syncvalue >> 32));
+	if (!c->syncalarm) {
+		aa.trigger.counter = c->synccounter;
+		aa.trigger.value_type = XSyncAbsolute;
+		aa.trigger.test_type = XSyncPositiveComparison;
+		XSyncIntToValue(&aa.delta, 0);
+		aa.events = True;
+		c->syncalarm = XSyncCreateAlarm(dpy, XSyncCACounter|XSyncCAValueType
+			|XSyncCATestType|XSyncCAValue|XSyncCADelta|XSyncCAEvents, &aa);
+		winadd(c->syncalarm, WinSyncAlarm, c);
+	} else
+		XSyncChangeAlarm(dpy, c->syncalarm, XSyncCAValue, &aa);
+	sendevent(c->win, wmatom[WMProtocols], NoEventMask, netatom[NetWMSyncRequest],
+		CurrentTime, c->syncvalue & 0xffffffff, c->syncvalue >> 32, 0);
+	c->syncwait = 1;
+	clock_gettime(CLOCK_MONOTONIC, &c->syncsent);
+	if (!deadlines[TimerSync].tv_sec && !deadlines[TimerSync].tv_nsec)
+		settimer(TimerSync, synctimeout);
+}
+
 void
 tag(const Arg *arg)
 {
 	if (selmon->sel && arg->ui & TAGMASK) {
 		selmon->sel->tags = arg->ui & TAGMASK;
+		selmon->ixvalid = 0;
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -3854,155 +5550,139 @@ tagmon(const Arg *arg)
 void
 tile(Monitor *m)
 {
-	char sym1 = 61, sym2 = 93, sym3 = 61, sym;
-	int x1 = m->wx + m->gappx, y1 = m->wy + m->gappx, h1 = m->wh - m->gappx, w1 = m->ww - m->gappx, X1 = x1 + w1, Y1 = y1 + h1;
-	int x2 = m->wx + m->gappx, y2 = m->wy + m->gappx, h2 = m->wh - m->gappx, w2 = m->ww - m->gappx, X2 = x2 + w2, Y2 = y2 + h2;
-	unsigned int i, n, n1, n2, bw;
-	Client *c, *s, *d, *t, *o;
-	float mfacts = 0, sfacts = 0;
-
-	if (notileborder == 1 && m->gappx > borderpx)
-		bw = 0;
-	else
-		bw = borderpx;
+	LayoutArgs a;
 
-	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++) {
-		if (n < m->nmaster)
-			mfacts += c->cfact;
-		else
-			sfacts += c->cfact;
+	updateindex(m);
+	if(m->nmaster > m->ntiled)
+		m->nmaster = (m->ntiled == 0) ? 1 : m->ntiled;
+	layoutargs(m, &a);
+	if (!layoutcached(m, &a, tile)) {
+		tilelayout(&a, m->cfacts, m->ntiled, m->rects, m->ltsymbol, sizeof m->ltsymbol);
+		memostore(m, &a, tile);
 	}
-	if(m->nmaster > n)
-		m->nmaster = (n == 0) ? 1 : n;
+	commitlayout(m, a.bw);
+}
+
+/* computes the tile geometry of n clients into r without touching the
+ * server, cfsum holds the prefix sums of their cfacts */
+void
+tilelayout(const LayoutArgs *a, const float *cfsum, unsigned int n, Rect *r, char *ltsym, size_t symlen)
+{
+	char sym1 = 61, sym2 = 93, sym3 = 61, sym;
+	int x1 = a->wx + a->gappx, y1 = a->wy + a->gappx, h1 = a->wh - a->gappx, w1 = a->ww - a->gappx, X1 = x1 + w1, Y1 = y1 + h1;
+	int x2 = a->wx + a->gappx, y2 = a->wy + a->gappx, h2 = a->wh - a->gappx, w2 = a->ww - a->gappx, X2 = x2 + w2, Y2 = y2 + h2;
+	int bw = a->bw, gappx = a->gappx, nmaster = a->nmaster;
+	unsigned int i, j, n1, n2;
+	float mfacts, sfacts;
+
+	mfacts = cfsum[MIN(nmaster, n)];
+	sfacts = cfsum[n] - mfacts;
 	/* layout symbol */
-	if(abs(m->ltaxis[0]) == m->ltaxis[1])    /* explicitly: ((abs(m->ltaxis[0]) == 1 && m->ltaxis[1] == 1) || (abs(m->ltaxis[0]) == 2 && m->ltaxis[1] == 2)) */
+	if(abs(a->ltaxis[0]) == a->ltaxis[1])    /* explicitly: ((abs(a->ltaxis[0]) == 1 && a->ltaxis[1] == 1) || (abs(a->ltaxis[0]) == 2 && a->ltaxis[1] == 2)) */
 		sym1 = 124;
-	if(abs(m->ltaxis[0]) == m->ltaxis[2])
+	if(abs(a->ltaxis[0]) == a->ltaxis[2])
 		sym3 = 124;
-	if(m->ltaxis[1] == 3)
-		sym1 = (n == 0) ? 0 : m->nmaster;
-	if(m->ltaxis[2] == 3)
-		sym3 = (n == 0) ? 0 : n - m->nmaster;
-	if(m->ltaxis[0] < 0) {
+	if(a->ltaxis[1] == 3)
+		sym1 = (n == 0) ? 0 : nmaster;
+	if(a->ltaxis[2] == 3)
+		sym3 = (n == 0) ? 0 : n - nmaster;
+	if(a->ltaxis[0] < 0) {
 		sym = sym1;
 		sym1 = sym3;
 		sym2 = 91;
 		sym3 = sym;
 	}
-	if(m->nmaster == 1) {
-		if(m->ltaxis[0] > 0)
+	if(nmaster == 1) {
+		if(a->ltaxis[0] > 0)
 			sym1 = 91;
 		else
 			sym3 = 93;
 	}
-	if(m->nmaster > 1 && m->ltaxis[1] == 3 && m->ltaxis[2] == 3)
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "%d%c%d", sym1, sym2, sym3);
-	else if((m->nmaster > 1 && m->ltaxis[1] == 3 && m->ltaxis[0] > 0) || (m->ltaxis[2] == 3 && m->ltaxis[0] < 0))
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "%d%c%c", sym1, sym2, sym3);
-	else if((m->ltaxis[2] == 3 && m->ltaxis[0] > 0) || (m->nmaster > 1 && m->ltaxis[1] == 3 && m->ltaxis[0] < 0))
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "%c%c%d", sym1, sym2, sym3);
+	if(nmaster > 1 && a->ltaxis[1] == 3 && a->ltaxis[2] == 3)
+		snprintf(ltsym, symlen, "%d%c%d", sym1, sym2, sym3);
+	else if((nmaster > 1 && a->ltaxis[1] == 3 && a->ltaxis[0] > 0) || (a->ltaxis[2] == 3 && a->ltaxis[0] < 0))
+		snprintf(ltsym, symlen, "%d%c%c", sym1, sym2, sym3);
+	else if((a->ltaxis[2] == 3 && a->ltaxis[0] > 0) || (nmaster > 1 && a->ltaxis[1] == 3 && a->ltaxis[0] < 0))
+		snprintf(ltsym, symlen, "%c%c%d", sym1, sym2, sym3);
 	else
-		snprintf(m->ltsymbol, sizeof m->ltsymbol, "%c%c%c", sym1, sym2, sym3);
+		snprintf(ltsym, symlen, "%c%c%c", sym1, sym2, sym3);
 	if (n == 0)
 		return;
 
 	/* master and stack area */
-	if(abs(m->ltaxis[0]) == 1 && n > m->nmaster) {
-		w1 *= m->mfact;
+	if(abs(a->ltaxis[0]) == 1 && n > nmaster) {
+		w1 *= a->mfact;
 		w2 -= w1;
-		x1 += (m->ltaxis[0] < 0) ? w2 : 0;
-		x2 += (m->ltaxis[0] < 0) ? 0 : w1;
-	} else if(abs(m->ltaxis[0]) == 2 && n > m->nmaster) {
-		h1 *= m->mfact;
+		x1 += (a->ltaxis[0] < 0) ? w2 : 0;
+		x2 += (a->ltaxis[0] < 0) ? 0 : w1;
+	} else if(abs(a->ltaxis[0]) == 2 && n > nmaster) {
+		h1 *= a->mfact;
 		h2 -= h1;
-		y1 += (m->ltaxis[0] < 0) ? h2 : 0;
-		y2 += (m->ltaxis[0] < 0) ? 0 : h1;
+		y1 += (a->ltaxis[0] < 0) ? h2 : 0;
+		y2 += (a->ltaxis[0] < 0) ? 0 : h1;
 	}
 
-	if(m->gappx == 0) {
-		if(abs(m->showbar) + abs(m->showebar) == 0) {
+	if(gappx == 0) {
+		if(a->nobars) {
 			y1 -= topbar ? borderpx : 0;	h1 += borderpx;
 			y2 -= topbar ? borderpx : 0;	h2 += borderpx;
 		}
-		if(abs(m->ltaxis[0]) == 1 && n > m->nmaster) {
+		if(abs(a->ltaxis[0]) == 1 && n > nmaster) {
 			h1 += borderpx;			h2 += borderpx;
 			w1 += borderpx;			w2 += borderpx;
-			if(m->ltaxis[0] < 0)	x2 -= borderpx;
+			if(a->ltaxis[0] < 0)	x2 -= borderpx;
 			else					x1 -= borderpx;
-			if(m->topbar == 0) {	y1 -= borderpx;	y2 -= borderpx; }
+			if(a->mtopbar == 0) {	y1 -= borderpx;	y2 -= borderpx; }
 		}
-		if(abs(m->ltaxis[0]) == 2 && n > m->nmaster) {
+		if(abs(a->ltaxis[0]) == 2 && n > nmaster) {
 			w1 += 2 * borderpx;		w2 += 2 * borderpx;
 			x1 -= borderpx;			x2 -= borderpx;
-			if(m->topbar == 0) {	h1 += borderpx;	y1 -= borderpx; }
+			if(a->mtopbar == 0) {	h1 += borderpx;	y1 -= borderpx; }
 			else					h2 += borderpx;
 		}
 		if(n == 1) {
 			h1 += borderpx;			h2 += borderpx;
 			w1 += 2 * borderpx;		w2 += 2 * borderpx;
 			x2 -= borderpx;			x1 -= borderpx;
-			if(m->topbar == 0) {	y1 -= borderpx;	y2 -= borderpx; }
+			if(a->mtopbar == 0) {	y1 -= borderpx;	y2 -= borderpx; }
 		}
 	}
 
 	X1 = x1 + w1; X2 = x2 + w2; Y1 = y1 + h1; Y2 = y2 + h2;
 
-	/* master */
-	n1 = (m->ltaxis[1] != 1 || w1 < (bh + m->gappx + 2 * borderpx) * (m->nmaster + 1)) ? 1 : m->nmaster;
-	n2 = (m->ltaxis[1] != 2 || h1 < (bh + m->gappx + 2 * borderpx) * (m->nmaster + 1)) ? 1 : m->nmaster;
-	for(i = 0, o = c = nexttiled(m->clients); i < m->nmaster; o = c = nexttiled(c->next), i++) {
-		resize(c, x1, y1,
-			(m->ltaxis[1] == 1 && i + 1 == m->nmaster) ? X1 - x1 - 2 * bw - m->gappx : w1 * (n1 > 1 ? (c->cfact / mfacts) : 1) - 2 * bw - m->gappx,
-			(m->ltaxis[1] == 2 && i + 1 == m->nmaster) ? Y1 - y1 - 2 * bw - m->gappx : h1 * (n2 > 1 ? (c->cfact / mfacts) : 1) - 2 * bw - m->gappx,
-			bw, 0);
+	/* master, on the z-axis only the topmost one stays in sight */
+	n1 = (a->ltaxis[1] != 1 || w1 < (bh + gappx + 2 * borderpx) * (nmaster + 1)) ? 1 : nmaster;
+	n2 = (a->ltaxis[1] != 2 || h1 < (bh + gappx + 2 * borderpx) * (nmaster + 1)) ? 1 : nmaster;
+	for(i = 0; i < nmaster; i++) {
+		r[i].x = x1;
+		r[i].y = y1;
+		r[i].w = (a->ltaxis[1] == 1 && i + 1 == nmaster) ? X1 - x1 - 2 * bw - gappx : w1 * (n1 > 1 ? ((cfsum[i + 1] - cfsum[i]) / mfacts) : 1) - 2 * bw - gappx;
+		r[i].h = (a->ltaxis[1] == 2 && i + 1 == nmaster) ? Y1 - y1 - 2 * bw - gappx : h1 * (n2 > 1 ? ((cfsum[i + 1] - cfsum[i]) / mfacts) : 1) - 2 * bw - gappx;
+		r[i].flags = (n1 > 1 ? RectCascadeX : 0) | (n2 > 1 ? RectCascadeY : 0)
+			| (i + 1 == nmaster ? RectFill : 0)
+			| (a->ltaxis[1] == 3 && (int)i != a->mtop ? RectHide : 0);
 		if(n1 > 1)
-			x1 = c->x + WIDTH(c) + m->gappx;
+			x1 = r[i].x + r[i].w + 2 * bw + gappx;
 		if(n2 > 1)
-			y1 = c->y + HEIGHT(c) + m->gappx;
-	}
-	if(m->ltaxis[1] == 3) {
-		for(i = 0, o = d = nexttiled(m->clients); i < m->nmaster; o = d = nexttiled(d->next), i++) {
-			XMoveWindow(dpy, d->win, WIDTH(d) * -2, d->y);
-		}
-		for (t = m->stack; t; t = t->snext) {
-			if (!ISVISIBLE(t) || t->isfloating)
-				continue;
-			for (i = 0, d = nexttiled(m->clients); d && d != t; d = nexttiled(d->next), i++);
-			if (i >= m->nmaster)
-				continue;
-			XMoveWindow(dpy, t->win, x1, y1);
-//			resize(t, x1, y1, w1 - 2 * bw - m->gappx, h1 - 2 * bw - m->gappx, bw, 0);
-			break;
-		}
+			y1 = r[i].y + r[i].h + 2 * bw + gappx;
 	}
 
 	/* stack */
-	if(n > m->nmaster) {
-		n1 = (m->ltaxis[2] != 1 || w2 < (bh + m->gappx + 2 * borderpx) * (n - m->nmaster + 1)) ? 1 : n - m->nmaster;
-		n2 = (m->ltaxis[2] != 2 || h2 < (bh + m->gappx + 2 * borderpx) * (n - m->nmaster + 1)) ? 1 : n - m->nmaster;
-			for(i = 0, c = o; c; c = nexttiled(c->next), i++) {
-				resize(c, x2, y2, 
-					(m->ltaxis[2] == 1 && i + 1 == n - m->nmaster) ? X2 - x2 - 2 * bw - m->gappx : w2 * (n1 > 1 ? (c->cfact / sfacts) : 1) - 2 * bw - m->gappx, 
-					(m->ltaxis[2] == 2 && i + 1 == n - m->nmaster) ? Y2 - y2 - 2 * bw - m->gappx : h2 * (n2 > 1 ? (c->cfact / sfacts) : 1) - 2 * bw - m->gappx,
-					bw, 0);
-				if(n1 > 1)
-					x2 = c->x + WIDTH(c) + m->gappx;
-				if(n2 > 1)
-					y2 = c->y + HEIGHT(c) + m->gappx;
-			}
-		if(m->ltaxis[2] == 3) {
-			for(i = 0, c = o; c; c = nexttiled(c->next), i++)
-				XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
-			for (s = m->stack; s; s = s->snext) {
-				if (!ISVISIBLE(s) || s->isfloating)
-					continue;
-				for (i = 0, c = nexttiled(m->clients); c && c != s; c = nexttiled(c->next), i++);
-				if (i < m->nmaster)
-					continue;
-				resize(c, x2, y2, w2 - 2 * bw - m->gappx, h2 - 2 * bw - m->gappx, bw, 0);
-				XMoveWindow(dpy, c->win, x2, y2);
-				break;
-			}
+	if(n > nmaster) {
+		n1 = (a->ltaxis[2] != 1 || w2 < (bh + gappx + 2 * borderpx) * (n - nmaster + 1)) ? 1 : n - nmaster;
+		n2 = (a->ltaxis[2] != 2 || h2 < (bh + gappx + 2 * borderpx) * (n - nmaster + 1)) ? 1 : n - nmaster;
+		for(i = nmaster, j = 0; i < n; i++, j++) {
+			r[i].x = x2;
+			r[i].y = y2;
+			r[i].w = (a->ltaxis[2] == 1 && j + 1 == n - nmaster) ? X2 - x2 - 2 * bw - gappx : w2 * (n1 > 1 ? ((cfsum[i + 1] - cfsum[i]) / sfacts) : 1) - 2 * bw - gappx;
+			r[i].h = (a->ltaxis[2] == 2 && j + 1 == n - nmaster) ? Y2 - y2 - 2 * bw - gappx : h2 * (n2 > 1 ? ((cfsum[i + 1] - cfsum[i]) / sfacts) : 1) - 2 * bw - gappx;
+			r[i].flags = (n1 > 1 ? RectCascadeX : 0) | (n2 > 1 ? RectCascadeY : 0)
+				| (i + 1 == n ? RectFill : 0)
+				| (a->ltaxis[2] == 3 && (int)i != a->stop ? RectHide : 0);
+			if(n1 > 1)
+				x2 = r[i].x + r[i].w + 2 * bw + gappx;
+			if(n2 > 1)
+				y2 = r[i].y + r[i].h + 2 * bw + gappx;
 		}
 	}
 }
@@ -4025,7 +5705,7 @@ togglebar(const Arg *arg)
 	}
 	XMoveResizeWindow(dpy, selmon->barwin, selmon->wx, selmon->by, selmon->ww, bh);
 	XMoveResizeWindow(dpy, selmon->ebarwin, selmon->wx, selmon->eby, selmon->ww, bh);
-	arrange(selmon);
+	deferview(selmon, 0);
 }
 
 void
@@ -4046,7 +5726,7 @@ toggleebar(const Arg *arg)
 	}
     XMoveResizeWindow(dpy, selmon->ebarwin, selmon->wx, selmon->eby, selmon->ww, bh);
 	XMoveResizeWindow(dpy, selmon->barwin, selmon->wx, selmon->by, selmon->ww, bh);
-    arrange(selmon);
+	deferview(selmon, 0);
 }
 
 void
@@ -4068,6 +5748,7 @@ togglefloating(const Arg *arg)
 	if (!selmon->sel)
 		return;
 	selmon->sel->isfloating = !selmon->sel->isfloating || selmon->sel->isfixed;
+	selmon->ixvalid = 0;
 	if (selmon->sel->isfloating)
 		/* restore last known float dimensions */
 		resize(selmon->sel, selmon->sel->sfx, selmon->sel->sfy,
@@ -4082,6 +5763,7 @@ togglefloating(const Arg *arg)
 		selmon->sel->sfh = selmon->sel->h + (selmon->gappx > borderpx ? 2 * borderpx : 0);
 	}
 	shadowfloat(selmon->sel);
+	memoinvalidate(selmon);
 	arrange(selmon);
 	arrangemon(selmon);
 }
@@ -4102,6 +5784,7 @@ togglescratch(const Arg *arg)
 	for (c = selmon->clients; c && !(found = c->scratchkey == ((char**)arg->v)[0][0]); c = c->next);
 	if (found) {
 		c->tags = ISVISIBLE(c) ? 0 : selmon->tagset[selmon->seltags];
+		selmon->ixvalid = 0;
 		focus(NULL);
 		arrange(selmon);
 
@@ -4126,6 +5809,7 @@ toggletag(const Arg *arg)
 	newtags = selmon->sel->tags ^ (arg->ui & TAGMASK);
 	if (newtags) {
 		selmon->sel->tags = newtags;
+		selmon->ixvalid = 0;
 		if(newtags == ~0) {
 			selmon->pertag->prevtag = selmon->pertag->curtag;
 			selmon->pertag->curtag = 0;
@@ -4153,7 +5837,9 @@ toggletag(const Arg *arg)
 void
 toggleview(const Arg *arg)
 {
-	unsigned int newtagset = selmon->tagset[selmon->seltags] ^ (arg->ui & TAGMASK);
+	unsigned int oldtagset = selmon->tagset[selmon->seltags];
+	unsigned int newtagset = oldtagset ^ (arg->ui & TAGMASK);
+	const Layout *oldlt = selmon->lt[selmon->sellt];
 	int i;
 
 	Client *const selected = selmon->sel;
@@ -4172,6 +5858,7 @@ toggleview(const Arg *arg)
 	focus(selected);
 	if (newtagset) {
 		selmon->tagset[selmon->seltags] = newtagset;
+		selmon->ixvalid = 0;
 
 		if (newtagset == ~0) {
 			selmon->pertag->prevtag = selmon->pertag->curtag;
@@ -4197,8 +5884,9 @@ toggleview(const Arg *arg)
 		if (selmon->showebar != selmon->pertag->showebars[selmon->pertag->curtag])
 			toggleebar(NULL);
 
-		focus(NULL);
-		arrange(selmon);
+		/* only the clients whose visibility flips need to move */
+		deferview(selmon, selmon->lt[selmon->sellt] == oldlt ? oldtagset ^ newtagset : ~0);
+		focuspending = 1;
 	}
 }
 
@@ -4228,14 +5916,22 @@ unmanage(Client *c, int destroyed)
 	Client *s;
 	Monitor *m = c->mon;
 	XWindowChanges wc;
+	unsigned int switchtotag = c->switchtotag;
 
 	if (c->swallowing)
 		unswallow(c);
 
 	s = swallowingclient(c->win);
-	if (s)
+	if (s) {
 		s->swallowing = NULL;
+		windel(c->win, WinSwallowed);
+	}
+	windel(c->win, WinClient);
+	syncdrop(c);
 
+	if (c == prevzoom)
+		prevzoom = NULL;
+	memoinvalidate(m);
 	detach(c);
 	detachstack(c);
 	if (!destroyed) {
@@ -4250,11 +5946,11 @@ unmanage(Client *c, int destroyed)
 		XUngrabServer(dpy);
 	}
 	free(c);
-	focus(NULL);
-	updateclientlist();
-	arrange(m);
-	if (c->switchtotag) {
-		Arg a = { .ui = c->switchtotag };
+	/* a burst of closing windows is laid out once */
+	focuspending = clientlistpending = 1;
+	deferarrange(m);
+	if (switchtotag) {
+		Arg a = { .ui = switchtotag };
 		view(&a);
 	}
 }
@@ -4275,7 +5971,7 @@ unmapnotify(XEvent *e)
 		 * _not_ destroy them. We map those windows back */
 		XMapRaised(dpy, c->win);
 		removesystrayicon(c);
-		updatesystray();
+		markbar(systraytomon(NULL), BarSystray);
 	}
 }
 
@@ -4305,6 +6001,7 @@ updatebars(void)
 				XMapRaised(dpy, systray->win);
 			XMapRaised(dpy, m->barwin);
 			XSetClassHint(dpy, m->barwin, &ch);
+			winadd(m->barwin, WinBar, m);
 		}
         if(!m->ebarwin) {
 			m->ebarwin = XCreateWindow(dpy, root, m->wx, m->eby, mons->ww, bh, 0, depth,
@@ -4313,6 +6010,7 @@ updatebars(void)
 			XDefineCursor(dpy, m->ebarwin, cursor[CurNormal]->cursor);
 			XMapRaised(dpy, m->ebarwin);
 			XSetClassHint(dpy, m->ebarwin, &ch);
+			winadd(m->ebarwin, WinBar, m);
 		}
 	}
 }
@@ -4348,13 +6046,19 @@ updateclientlist()
 {
 	Client *c;
 	Monitor *m;
+	Window *wins;
+	int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+			n++;
+	wins = ecalloc(n + 1, sizeof(Window));
+	for (n = 0, m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			wins[n++] = c->win;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *)wins, n);
+	free(wins);
 }
 
 int
@@ -4404,7 +6108,7 @@ updategeom(void)
 				for (m = mons; m && m->next; m = m->next);
 				while ((c = m->clients)) {
 					dirty = 1;
-					m->clients = c->next;
+					detach(c);
 					detachstack(c);
 					c->mon = mons;
 					switch(attachdirection){
@@ -4478,60 +6182,144 @@ updatesizehints(Client *c)
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
-	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
-	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
+	setsizehints(c, &size);
+}
+
+void
+setsizehints(Client *c, XSizeHints *size)
+{
+	if (size->flags & PBaseSize) {
+		c->basew = size->base_width;
+		c->baseh = size->base_height;
+	} else if (size->flags & PMinSize) {
+		c->basew = size->min_width;
+		c->baseh = size->min_height;
 	} else
 		c->basew = c->baseh = 0;
-	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
+	if (size->flags & PResizeInc) {
+		c->incw = size->width_inc;
+		c->inch = size->height_inc;
 	} else
 		c->incw = c->inch = 0;
-	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
+	if (size->flags & PMaxSize) {
+		c->maxw = size->max_width;
+		c->maxh = size->max_height;
 	} else
 		c->maxw = c->maxh = 0;
-	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
-	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
+	if (size->flags & PMinSize) {
+		c->minw = size->min_width;
+		c->minh = size->min_height;
+	} else if (size->flags & PBaseSize) {
+		c->minw = size->base_width;
+		c->minh = size->base_height;
 	} else
 		c->minw = c->minh = 0;
-	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
+	if (size->flags & PAspect) {
+		c->mina = (float)size->min_aspect.y / size->min_aspect.x;
+		c->maxa = (float)size->max_aspect.x / size->max_aspect.y;
 	} else
 		c->maxa = c->mina = 0.0;
 	c->isfixed = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
 }
 
+void
+setupevents(void)
+{
+	int i;
+#ifdef __linux__
+	struct epoll_event ev = { .events = EPOLLIN };
+#else
+	int fds[2];
+	struct sigaction sa = { .sa_handler = sigwakeup };
+#endif /* __linux__ */
+
+	xfd = ConnectionNumber(dpy);
+	sigemptyset(&sigmask);
+	for (i = 0; i < LENGTH(handledsigs); i++)
+		sigaddset(&sigmask, handledsigs[i]);
+#ifdef __linux__
+	/* signals are only read from the signalfd, never delivered */
+	if (sigprocmask(SIG_BLOCK, &sigmask, &origsigmask) == -1)
+		die("sigprocmask:");
+	if ((sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK|SFD_CLOEXEC)) == -1)
+		die("signalfd:");
+	if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) == -1)
+		die("timerfd_create:");
+	if ((pollfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		die("epoll_create1:");
+	ev.data.fd = xfd;
+	if (epoll_ctl(pollfd, EPOLL_CTL_ADD, xfd, &ev) == -1)
+		die("epoll_ctl:");
+	ev.data.fd = sigfd;
+	if (epoll_ctl(pollfd, EPOLL_CTL_ADD, sigfd, &ev) == -1)
+		die("epoll_ctl:");
+	ev.data.fd = timerfd;
+	if (epoll_ctl(pollfd, EPOLL_CTL_ADD, timerfd, &ev) == -1)
+		die("epoll_ctl:");
+#else
+	/* the handlers only write the signal number to a pipe */
+	sigprocmask(SIG_BLOCK, NULL, &origsigmask);
+	if (pipe(fds) == -1)
+		die("pipe:");
+	pollfd = fds[0];
+	sigfd = fds[1];
+	for (i = 0; i < 2; i++) {
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[i], F_SETFL, O_NONBLOCK);
+	}
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < LENGTH(handledsigs); i++)
+		if (sigaction(handledsigs[i], &sa, NULL) == -1)
+			die("sigaction:");
+#endif /* __linux__ */
+}
+
+int
+textprop(XTextProperty *name, char *text, unsigned int size)
+{
+	char **list = NULL;
+	int n;
+
+	if (name->encoding == XA_STRING) {
+		/* property data is not terminated */
+		n = MIN(size - 1, name->nitems);
+		strncpy(text, (char *)name->value, n);
+		text[n] = '\0';
+	} else {
+		if (XmbTextPropertyToTextList(dpy, name, &list, &n) >= Success && n > 0 && *list) {
+			strncpy(text, *list, size - 1);
+			XFreeStringList(list);
+		}
+	}
+	text[size - 1] = '\0';
+	return 1;
+}
+
 void
 updatestatus(void)
 {
-	int now;
 	if (!gettextprop(root, XA_WM_NAME, rawstext, sizeof(rawstext)))
 		strcpy(rawstext, "dwm-"VERSION);
 	else {
-		now = time(NULL);
 		if (strncmp(istatusclose, rawstext, strlen(istatusclose)) == 0) {
-			istatustimer = 0;
+			istatustimer = istatuspending = 0;
+			settimer(TimerStatus, -1);
 			return;
 		} else if (strncmp(istatusprefix, rawstext, strlen(istatusprefix)) == 0) {
-			istatustimer = now;
+			istatustimer = 1;
+			istatuspending = 0;
+			settimer(TimerStatus, istatustimeout * 1000);
 			copyvalidchars(rawstext, rawstext + sizeof(char) * strlen(istatusprefix) );
-		} else if (now == -1 || now - istatustimer > istatustimeout) {
+		} else if (!istatustimer) {
 			copyvalidchars(stext, rawstext);
-		} else
+		} else {
+			/* redrawn by istatusexpire() */
+			istatuspending = 1;
 			return;
+		}
 	}
-	drawebar(rawstext, selmon, 0);
+	markbar(selmon, BarStatus);
 }
 
 void
@@ -4574,7 +6362,6 @@ updatesystray(void)
 		XSetSelectionOwner(dpy, netatom[NetSystemTray], systray->win, CurrentTime);
 		if (XGetSelectionOwner(dpy, netatom[NetSystemTray]) == systray->win) {
 			sendevent(root, xatom[Manager], StructureNotifyMask, CurrentTime, netatom[NetSystemTray], systray->win, 0, 0);
-			XSync(dpy, False);
 		}
 		else {
 			fprintf(stderr, "dwm: unable to obtain system tray.\n");
@@ -4612,7 +6399,6 @@ updatesystray(void)
 	/* redraw background */
 	XSetForeground(dpy, drw->gc, scheme[SchemeBar][bartheme ? ColFloat : ColBg].pixel);
 	XFillRectangle(dpy, systray->win, drw->gc, 0, 0, w, bh);
-	XSync(dpy, False);
 }
 
 void
@@ -4666,6 +6452,56 @@ updatesystrayiconstate(Client *i, XPropertyEvent *ev)
 			systray->win, XEMBED_EMBEDDED_VERSION);
  }
 
+void
+updateindex(Monitor *m)
+{
+	unsigned int i, n;
+	Client *c;
+
+	if (m->ixvalid)
+		return;
+	for (n = 0, c = m->clients; c; c = c->next, n++);
+	if (n >= m->ixsize) {
+		free(m->vis);
+		free(m->tiled);
+		free(m->floating);
+		free(m->cfacts);
+		free(m->rects);
+		m->ixsize = MAX(16, 2 * n);
+		m->vis = ecalloc(m->ixsize + 1, sizeof(Client *));
+		m->tiled = ecalloc(m->ixsize + 1, sizeof(Client *));
+		m->floating = ecalloc(m->ixsize + 1, sizeof(Client *));
+		m->cfacts = ecalloc(m->ixsize + 1, sizeof(float));
+		m->rects = ecalloc(m->ixsize + 1, sizeof(Rect));
+	}
+	m->nvis = m->ntiled = m->nfloating = 0;
+	m->occ = m->urg = 0;
+	m->cfacts[0] = 0;
+	memset(m->pertag->nclients, 0, sizeof m->pertag->nclients);
+	for (c = m->clients; c; c = c->next) {
+		c->visidx = c->tileidx = -1;
+		m->occ |= c->tags == 255 ? 0 : c->tags;
+		if (c->isurgent)
+			m->urg |= c->tags;
+		for (i = 0; i < LENGTH(tags); i++)
+			if (c->tags & 1 << i)
+				c->tagrank[i] = m->pertag->nclients[i]++;
+		if (!ISVISIBLE(c))
+			continue;
+		c->visidx = m->nvis;
+		m->vis[m->nvis++] = c;
+		if (c->isfloating)
+			m->floating[m->nfloating++] = c;
+		else {
+			c->tileidx = m->ntiled;
+			m->tiled[m->ntiled++] = c;
+			m->cfacts[m->ntiled] = m->cfacts[m->ntiled - 1] + c->cfact;
+		}
+	}
+	m->vis[m->nvis] = m->tiled[m->ntiled] = m->floating[m->nfloating] = NULL;
+	m->ixvalid = 1;
+}
+
 void
 updatetitle(Client *c)
 {
@@ -4678,13 +6514,19 @@ updatetitle(Client *c)
 void
 updatewindowtype(Client *c)
 {
-	Atom state = getatomprop(c, netatom[NetWMState]);
-	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
+	setwindowtype(c, getatomprop(c, netatom[NetWMState]),
+		getatomprop(c, netatom[NetWMWindowType]));
+}
 
+void
+setwindowtype(Client *c, Atom state, Atom wtype)
+{
 	if (state == netatom[NetWMFullscreen])
 		setfullscreen(c, 1);
-	if (wtype == netatom[NetWMWindowTypeDialog])
+	if (wtype == netatom[NetWMWindowTypeDialog]) {
 		c->isfloating = 1;
+		c->mon->ixvalid = 0;
+	}
 }
 
 void
@@ -4693,28 +6535,39 @@ updatewmhints(Client *c)
 	XWMHints *wmh;
 
 	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
+		setwmhints(c, wmh);
 		XFree(wmh);
 	}
 }
 
+void
+setwmhints(Client *c, XWMHints *wmh)
+{
+	if (c == selmon->sel && wmh->flags & XUrgencyHint) {
+		wmh->flags &= ~XUrgencyHint;
+		XSetWMHints(dpy, c->win, wmh);
+	} else {
+		c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
+		if (c->mon)
+			c->mon->ixvalid = 0;
+	}
+	if (wmh->flags & InputHint)
+		c->neverfocus = !wmh->input;
+	else
+		c->neverfocus = 0;
+}
+
 void
 view(const Arg *arg)
 {
 	int i;
-	unsigned int tmptag;
+	unsigned int tmptag, oldtagset = selmon->tagset[selmon->seltags];
+	const Layout *oldlt = selmon->lt[selmon->sellt];
 
 	if ((arg->ui & TAGMASK) == selmon->tagset[selmon->seltags])
 		return;
 	selmon->seltags ^= 1; /* toggle sel tagset */
+	selmon->ixvalid = 0;
 	if (arg->ui & TAGMASK) {
 		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK;
 		selmon->pertag->prevtag = selmon->pertag->curtag;
@@ -4742,24 +6595,74 @@ view(const Arg *arg)
 		togglebar(NULL);
 	if (selmon->showebar != selmon->pertag->showebars[selmon->pertag->curtag])
 		toggleebar(NULL);
-	focus(NULL);
-	arrange(selmon);
+	/* only the clients whose visibility flips need to move */
+	deferview(selmon, selmon->lt[selmon->sellt] == oldlt
+		? oldtagset ^ selmon->tagset[selmon->seltags] : ~0);
+	focuspending = 1;
 }
 
-pid_t
-winpid(Window w)
+void
+waitevents(int timeout)
 {
-	pid_t result = 0;
+	int i, n;
+#ifdef __linux__
+	struct epoll_event evs[3];
+	struct signalfd_siginfo si;
+	uint64_t expirations;
+
+	if ((n = epoll_wait(pollfd, evs, LENGTH(evs), timeout)) == -1) {
+		if (errno != EINTR)
+			die("epoll_wait:");
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (evs[i].data.fd == sigfd)
+			while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+				handlesignal(si.ssi_signo);
+		else if (evs[i].data.fd == timerfd) {
+			while (read(timerfd, &expirations, sizeof(expirations)) > 0);
+			runtimers();
+		}
+	}
+#else
+	struct pollfd pfds[2] = { { .fd = xfd, .events = POLLIN }, { .fd = pollfd, .events = POLLIN } };
+	struct timespec now;
+	unsigned char sig;
+	long ms;
+
+	/* no timerfd here, sleep until the earliest deadline */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < TimerLast; i++) {
+		if (!deadlines[i].tv_sec && !deadlines[i].tv_nsec)
+			continue;
+		ms = (deadlines[i].tv_sec - now.tv_sec) * 1000
+		   + (deadlines[i].tv_nsec - now.tv_nsec) / 1000000 + 1;
+		if (timeout < 0 || ms < timeout)
+			timeout = MAX(ms, 0);
+	}
+	if ((n = poll(pfds, LENGTH(pfds), timeout)) == -1) {
+		if (errno != EINTR)
+			die("poll:");
+		return;
+	}
+	if (pfds[1].revents & POLLIN)
+		while (read(pollfd, &sig, 1) == 1)
+			handlesignal(sig);
+	runtimers();
+#endif /* __linux__ */
+}
 
 #ifdef __linux__
-	xcb_res_client_id_spec_t spec = {0};
-	spec.client = w;
-	spec.mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID;
+pid_t
+winpidreply(xcb_res_query_client_ids_cookie_t cookie)
+{
+	pid_t result = 0;
+	xcb_res_client_id_spec_t spec;
 
 	xcb_generic_error_t *e = NULL;
-	xcb_res_query_client_ids_cookie_t c = xcb_res_query_client_ids(xcon, 1, &spec);
-	xcb_res_query_client_ids_reply_t *r = xcb_res_query_client_ids_reply(xcon, c, &e);
+	xcb_res_query_client_ids_reply_t *r = xcb_res_query_client_ids_reply(xcon, cookie, &e);
 
+	free(e);
 	if (!r)
 		return (pid_t)0;
 
@@ -4777,7 +6680,14 @@ winpid(Window w)
 
 	if (result == (pid_t)-1)
 		result = 0;
-#endif /* __linux__ */
+	return result;
+}
+#else
+pid_t
+winpid(Window w)
+{
+	pid_t result = 0;
+
 #ifdef __OpenBSD__
 	Atom type;
 	int format;
@@ -4795,6 +6705,7 @@ winpid(Window w)
 
 	return result;
 }
+#endif /* __linux__ */
 
 pid_t
 getparentprocess(pid_t p)
@@ -4860,30 +6771,96 @@ termforwin(const Client *w)
 Client *
 swallowingclient(Window w)
 {
-	Client *c;
-	Monitor *m;
+	return winfind(w, WinSwallowed);
+}
 
-	for (m = mons; m; m = m->next) {
-		for (c = m->clients; c; c = c->next) {
-			if (c->swallowing && c->swallowing->win == w)
-				return c;
+void
+winadd(Window w, int type, void *p)
+{
+	unsigned int i, mask;
+	WinEntry *e = NULL;
+
+	if ((wintabfill + 1) * 2 > wintabsize)
+		winrehash();
+	mask = wintabsize - 1;
+	for (i = winhash(w, type) & mask; wintab[i].type != WinFree; i = (i + 1) & mask) {
+		if (wintab[i].type == type && wintab[i].win == w) {
+			wintab[i].p = p;
+			return;
 		}
+		if (wintab[i].type == WinDeleted && !e)
+			e = &wintab[i];
 	}
+	if (!e) {
+		e = &wintab[i];
+		wintabfill++;
+	}
+	e->win = w;
+	e->type = type;
+	e->p = p;
+	wintabused++;
+}
+
+void
+windel(Window w, int type)
+{
+	unsigned int i, mask;
+
+	if (!wintabsize)
+		return;
+	mask = wintabsize - 1;
+	for (i = winhash(w, type) & mask; wintab[i].type != WinFree; i = (i + 1) & mask)
+		if (wintab[i].type == type && wintab[i].win == w) {
+			wintab[i].type = WinDeleted;
+			wintab[i].p = NULL;
+			wintabused--;
+			return;
+		}
+}
+
+void *
+winfind(Window w, int type)
+{
+	unsigned int i, mask;
 
+	if (!wintabsize)
+		return NULL;
+	mask = wintabsize - 1;
+	for (i = winhash(w, type) & mask; wintab[i].type != WinFree; i = (i + 1) & mask)
+		if (wintab[i].type == type && wintab[i].win == w)
+			return wintab[i].p;
 	return NULL;
 }
 
+unsigned int
+winhash(Window w, int type)
+{
+	/* xids of one client differ in the low bits, the client part
+	 * starts at bit 21; odd multipliers keep the low bits distinct */
+	return (unsigned int)(w ^ w >> 21) * 2654435761U + type;
+}
+
+void
+winrehash(void)
+{
+	unsigned int i, size, n = wintabsize;
+	WinEntry *old = wintab;
+
+	/* drop deleted slots and keep the load below a quarter */
+	for (size = 64; size < (wintabused + 1) * 4; size *= 2);
+	wintab = ecalloc(size, sizeof(WinEntry));
+	wintabsize = size;
+	wintabused = wintabfill = 0;
+	for (i = 0; i < n; i++)
+		if (old[i].type > WinDeleted)
+			winadd(old[i].win, old[i].type, old[i].p);
+	free(old);
+}
+
 Client *
 wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
-
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	return winfind(w, WinClient);
 }
 
 Monitor *
@@ -4895,9 +6872,8 @@ wintomon(Window w)
 
 	if (w == root && getrootptr(&x, &y))
 		return recttomon(x, y, 1, 1);
-	for (m = mons; m; m = m->next)
-		if (w == m->barwin)
-			return m;
+	if ((m = winfind(w, WinBar)))
+		return m;
 	if ((c = wintoclient(w)))
 		return c->mon;
 	return selmon;
@@ -4909,8 +6885,7 @@ wintosystrayicon(Window w) {
 
 	if (!showsystray || !w)
 		return i;
-	for (i = systray->icons; i && i->win != w; i = i->next);
-	return i;
+	return winfind(w, WinTrayIcon);
 }
 
 /* There's no way to check accesses to destroyed windows, thus those cases are
@@ -4927,7 +6902,9 @@ xerror(Display *dpy, XErrorEvent *ee)
 	|| (ee->request_code == X_ConfigureWindow && ee->error_code == BadMatch)
 	|| (ee->request_code == X_GrabButton && ee->error_code == BadAccess)
 	|| (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
-	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable))
+	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable)
+	|| (syncerrbase && ee->error_code == syncerrbase + XSyncBadCounter)
+	|| (syncerrbase && ee->error_code == syncerrbase + XSyncBadAlarm))
 		return 0;
 	fprintf(stderr, "dwm: fatal error: request code=%d, error code=%d\n",
 		ee->request_code, ee->error_code);
@@ -4993,6 +6970,7 @@ xrdb(const Arg *arg)
   int i;
   for (i = 0; i < LENGTH(colors); i++)
                 scheme[i] = drw_scm_create(drw, colors[i], alphas[i], 4);
+  markbars(BarExposed);
   focus(NULL);
   arrange(NULL);
 }
@@ -5027,8 +7005,7 @@ zoom(const Arg *arg)
 		prevzoom = cold;
 		if (cold && at != cold) {
 			detach(cold);
-			cold->next = at->next;
-			at->next = cold;
+			attachafter(cold, at);
 		}
 	}
 	focus(c);
@@ -5053,7 +7030,7 @@ main(int argc, char *argv[])
         loadxrdb();
 	setup();
 #ifdef __OpenBSD__
-	if (pledge("stdio rpath proc exec ps", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath proc exec ps", NULL) == -1)
 		die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
@@ -5065,20 +7042,9 @@ main(int argc, char *argv[])
 
 void
 insertclient(Client *item, Client *insertItem, int after) {
-	Client *c;
 	if (item == NULL || insertItem == NULL || item == insertItem) return;
 	detach(insertItem);
-	if (!after && selmon->clients == item) {
-		attach(insertItem);
-		return;
-	}
-	if (after) {
-		c = item;
-	} else {
-		for (c = selmon->clients; c; c = c->next) { if (c->next == item) break; }
-	}
-	insertItem->next = c->next;
-	c->next = insertItem;
+	attachafter(insertItem, after ? item : item->prev);
 }
 
 void
@@ -5086,48 +7052,38 @@ inplacerotate(const Arg *arg)
 {
 	if(!selmon->sel || (selmon->sel->isfloating && !arg->f)) return;
 
-	unsigned int selidx = 0, i = 0;
+	unsigned int selidx = 0, n;
 	Client *c = NULL, *stail = NULL, *mhead = NULL, *mtail = NULL, *shead = NULL;
 
 	// Shift client
-	for (c = selmon->clients; c; c = c->next) {
-		if (ISVISIBLE(c) && !(c->isfloating)) {
-		if (selmon->sel == c) { selidx = i; }
-		if (i == selmon->nmaster - 1) { mtail = c; }
-		if (i == selmon->nmaster) { shead = c; }
-		if (mhead == NULL) { mhead = c; }
-		stail = c;
-		i++;
-		}
-	}
+	updateindex(selmon);
+	n = selmon->ntiled;
+	if (selmon->sel->tileidx >= 0) { selidx = selmon->sel->tileidx; }
+	if (n > 0) { mhead = selmon->tiled[0]; stail = selmon->tiled[n - 1]; }
+	if (selmon->nmaster >= 1 && selmon->nmaster <= n) { mtail = selmon->tiled[selmon->nmaster - 1]; }
+	if (selmon->nmaster < n) { shead = selmon->tiled[selmon->nmaster]; }
 	if (arg->i < 0 && selidx >= selmon->nmaster) insertclient(stail, shead, 1);
 	if (arg->i > 0 && selidx >= selmon->nmaster) insertclient(shead, stail, 0);
 	if (arg->i < 0 && selidx < selmon->nmaster)  insertclient(mtail, mhead, 1);
 	if (arg->i > 0 && selidx < selmon->nmaster)  insertclient(mhead, mtail, 0);
 
 	// Restore focus position
-	i = 0;
-	for (c = selmon->clients; c; c = c->next) {
-		if (!ISVISIBLE(c) || (c->isfloating)) continue;
-		if (i == selidx) { focus(c); break; }
-		i++;
-	}
+	updateindex(selmon);
+	if ((c = selmon->tiled[MIN(selidx, selmon->ntiled)])) { focus(c); }
 	arrange(selmon);
 	focus(c);
 }
 
 void
 transfer(const Arg *arg) {
-	Client *c, *mtail = selmon->clients, *stail = NULL, *insertafter;
-	int transfertostack = 0, i, nmasterclients;
-
-	for (i = 0, c = selmon->clients; c; c = c->next) {
-		if (!ISVISIBLE(c) || c->isfloating) continue;
-		if (selmon->sel == c) { transfertostack = i < selmon->nmaster && selmon->nmaster != 0; }
-		if (i < selmon->nmaster) { nmasterclients++; mtail = c; }
-		stail = c;
-		i++;
-	}
+	Client *mtail = selmon->clients, *stail = NULL, *insertafter;
+	int transfertostack = 0, i;
+
+	updateindex(selmon);
+	i = selmon->ntiled;
+	if (selmon->sel->tileidx >= 0) { transfertostack = selmon->sel->tileidx < selmon->nmaster && selmon->nmaster != 0; }
+	if (i > 0 && selmon->nmaster > 0) { mtail = selmon->tiled[MIN(selmon->nmaster, i) - 1]; }
+	if (i > 0) { stail = selmon->tiled[i - 1]; }
 	if (selmon->sel->isfloating || i == 0) {
 		return;
 	} else if (transfertostack) {
@@ -5142,8 +7098,7 @@ transfer(const Arg *arg) {
 		if (selmon->nmaster == 1 && !transfertostack) {
 		 attach(selmon->sel); // Head prepend case
 		} else {
-			selmon->sel->next = insertafter->next;
-			insertafter->next = selmon->sel;
+			attachafter(selmon->sel, insertafter);
 		}
 	}
 	arrange(selmon);